@@ -4,7 +4,18 @@ include $(CLEAR_VARS)
 LOCAL_SRC_FILES:= \
 	klaatuwifi_main.cpp \
 	StateMachine.cpp \
+	MessageQueue.cpp \
+	TimerQueue.cpp \
 	StringUtils.cpp \
+	ScanResults.cpp \
+	BssTable.cpp \
+	SupplicantChannel.cpp \
+	SupplicantEvents.cpp \
+	NetdClient.cpp \
+	LineReader.cpp \
+	DhcpLeaseCache.cpp \
+	SignalMonitor.cpp \
+	StationStore.cpp \
 	WifiStateMachine.cpp
 
 LOCAL_MODULE:= klaatu_wifiservice
@@ -15,7 +26,7 @@ LOCAL_C_INCLUDES += $(LOCAL_PATH)/../../include external/wpa_supplicant_6/wpa_su
 else
 LOCAL_C_INCLUDES += $(LOCAL_PATH)/../../include external/wpa_supplicant_8
 endif
-LOCAL_SHARED_LIBRARIES := libcutils libbinder libutils libklaatu_wifi libhardware libhardware_legacy libnetutils
+LOCAL_SHARED_LIBRARIES := libcutils libbinder libutils libklaatu_wifi libhardware libhardware_legacy libnetutils libwpa_client
 SVERSION:=$(subst ., ,$(PLATFORM_VERSION))
 LOCAL_CFLAGS += -DSHORT_PLATFORM_VERSION=$(word 1,$(SVERSION))$(word 2,$(SVERSION))
 ifeq ($(word 3,$(SVERSION)),)
@@ -31,3 +42,43 @@ include $(BUILD_EXECUTABLE)
 
 ALL_DEFAULT_INSTALLED_MODULES += $(TARGET_OUT)/bin/klaatu_wifiservice
 
+# Host benchmark for the StateMachine core (queue, timers, deferal)
+# and supplicant reply parsing
+ifeq ($(HOST_OS),linux)
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= \
+	StateMachineBenchmark.cpp \
+	MallocCounter.cpp \
+	StateMachine.cpp \
+	MessageQueue.cpp \
+	TimerQueue.cpp \
+	StringUtils.cpp \
+	ScanResults.cpp
+
+LOCAL_MODULE:= klaatu_wifi_benchmark
+LOCAL_MODULE_TAGS:=optional
+LOCAL_CFLAGS += -DWIFI_BENCHMARK
+LOCAL_STATIC_LIBRARIES := libutils libcutils liblog
+LOCAL_LDLIBS += -lpthread -lrt
+
+include $(BUILD_HOST_EXECUTABLE)
+
+# Host test: steady supplicant events and RSSI polls must not allocate
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= \
+	StateMachineAllocTest.cpp \
+	MallocCounter.cpp \
+	StateMachine.cpp \
+	MessageQueue.cpp \
+	TimerQueue.cpp
+
+LOCAL_MODULE:= klaatu_wifi_alloc_test
+LOCAL_MODULE_TAGS:=optional
+LOCAL_CFLAGS += -DWIFI_BENCHMARK
+LOCAL_STATIC_LIBRARIES := libutils libcutils liblog
+LOCAL_LDLIBS += -lpthread -lrt
+
+include $(BUILD_HOST_EXECUTABLE)
+endif
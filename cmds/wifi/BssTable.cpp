@@ -0,0 +1,145 @@
+/*
+   In-memory mirror of the supplicant BSS table
+ */
+
+#include "BssTable.h"
+
+namespace android {
+
+BssTable::BssTable()
+    : mGeneration(0)
+{
+}
+
+bool BssTable::update(const BssRecord& bss)
+{
+    String8 bssid(bss.bssid.toString8());
+    ssize_t index = mEntries.indexOfKey(bssid);
+    bool changed = true;
+    String8 oldSsid;
+
+    if (index < 0) {
+        Entry entry;
+        entry.level = bss.level;
+        index = mEntries.add(bssid, entry);
+    }
+    else {
+        const Entry& entry = mEntries.valueAt(index);
+        changed = entry.id != bss.id || entry.frequency != bss.frequency
+            || entry.level != bss.level || !bss.ssid.equals(entry.ssid.string())
+            || !bss.flags.equals(entry.flags.string());
+        oldSsid = entry.ssid;
+    }
+    Entry& entry = mEntries.editValueAt(index);
+    entry.seen = mGeneration;
+    if (!changed)
+        return false;
+
+    int oldLevel = entry.level;
+    entry.id = bss.id;
+    entry.bssid = bssid;
+    if (!bss.ssid.equals(entry.ssid.string()))
+        entry.ssid = bss.ssid.toString8();
+    if (!bss.flags.equals(entry.flags.string()))
+        entry.flags = bss.flags.toString8();
+    entry.frequency = bss.frequency;
+    entry.level = bss.level;
+
+    if (oldSsid.length() && oldSsid != entry.ssid && mBest.valueFor(oldSsid) == bssid)
+        recomputeBest(oldSsid);
+    if (entry.ssid.isEmpty())
+        return true;
+    ssize_t best = mBest.indexOfKey(entry.ssid);
+    if (best < 0)
+        mBest.add(entry.ssid, bssid);
+    else if (mBest.valueAt(best) == bssid) {
+        if (entry.level < oldLevel)
+            recomputeBest(entry.ssid);
+    }
+    else {
+        const Entry *current = find(mBest.valueAt(best).string());
+        if (!current || entry.level > current->level)
+            mBest.replaceValueAt(best, bssid);
+    }
+    return true;
+}
+
+bool BssTable::remove(const char *bssid)
+{
+    ssize_t index = mEntries.indexOfKey(String8(bssid));
+    if (index < 0)
+        return false;
+    String8 ssid(mEntries.valueAt(index).ssid);
+    mEntries.removeItemsAt(index);
+    if (!ssid.isEmpty() && mBest.valueFor(ssid) == bssid)
+        recomputeBest(ssid);
+    return true;
+}
+
+void BssTable::clear()
+{
+    mEntries.clear();
+    mBest.clear();
+}
+
+void BssTable::beginReconcile()
+{
+    mGeneration++;
+}
+
+size_t BssTable::endReconcile()
+{
+    size_t removed = 0;
+    for (size_t i = mEntries.size() ; i-- > 0 ; ) {
+        if (mEntries.valueAt(i).seen != mGeneration) {
+            mEntries.removeItemsAt(i);
+            removed++;
+        }
+    }
+    if (removed)
+        rebuildBest();
+    return removed;
+}
+
+const BssTable::Entry *BssTable::find(const char *bssid) const
+{
+    ssize_t index = mEntries.indexOfKey(String8(bssid));
+    return index < 0 ? NULL : &mEntries.valueAt(index);
+}
+
+const BssTable::Entry *BssTable::bestForSsid(const char *ssid) const
+{
+    ssize_t index = mBest.indexOfKey(String8(ssid));
+    return index < 0 ? NULL : find(mBest.valueAt(index).string());
+}
+
+void BssTable::recomputeBest(const String8& ssid)
+{
+    ssize_t best = -1;
+    for (size_t i = 0 ; i < mEntries.size() ; i++) {
+        const Entry& entry = mEntries.valueAt(i);
+        if (entry.ssid == ssid && (best < 0 || entry.level > mEntries.valueAt(best).level))
+            best = i;
+    }
+    if (best < 0)
+        mBest.removeItem(ssid);
+    else
+        mBest.replaceValueFor(ssid, mEntries.keyAt(best));
+}
+
+void BssTable::rebuildBest()
+{
+    mBest.clear();
+    for (size_t i = 0 ; i < mEntries.size() ; i++) {
+        const Entry& entry = mEntries.valueAt(i);
+        if (entry.ssid.isEmpty())
+            continue;
+        ssize_t best = mBest.indexOfKey(entry.ssid);
+        if (best < 0)
+            mBest.add(entry.ssid, mEntries.keyAt(i));
+        else if (entry.level > find(mBest.valueAt(best).string())->level)
+            mBest.replaceValueAt(best, mEntries.keyAt(i));
+    }
+}
+
+}; // namespace android
@@ -0,0 +1,53 @@
+/*
+  The supplicant's BSS table, mirrored in memory.
+
+  Entries are keyed by BSSID.  They are added and updated from parsed
+  BSS records (see ScanResults.h) and removed when the supplicant
+  reports CTRL-EVENT-BSS-REMOVED, so a scan only touches the BSSs that
+  changed.  A full read of the supplicant table is bracketed by
+  beginReconcile() / endReconcile(), which drops whatever it did not
+  see.  For every SSID the table also remembers the BSS with the
+  strongest signal.
+
+  A BssTable is not thread safe; it belongs to the StateMachine thread.
+ */
+
+#ifndef _BSS_TABLE_H
+#define _BSS_TABLE_H
+
+#include <utils/KeyedVector.h>
+#include <utils/String8.h>
+#include "ScanResults.h"
+
+namespace android {
+
+class BssTable {
+public:
+    struct Entry {
+        int      id;            // Supplicant BSS id
+        String8  bssid, ssid, flags;
+        int      frequency, level;
+        uint32_t seen;          // Reconcile generation
+    };
+    BssTable();
+    size_t   size() const { return mEntries.size(); }
+    const Entry& entryAt(size_t index) const { return mEntries.valueAt(index); }
+    // Returns true if the entry is new or any of its fields changed
+    bool     update(const BssRecord& bss);
+    bool     remove(const char *bssid);
+    void     clear();
+    void     beginReconcile();
+    size_t   endReconcile();            // Returns the number removed
+    const Entry *find(const char *bssid) const;
+    const Entry *bestForSsid(const char *ssid) const;
+private:
+    void     recomputeBest(const String8& ssid);
+    void     rebuildBest();
+    KeyedVector<String8, Entry>   mEntries;   // By BSSID
+    KeyedVector<String8, String8> mBest;      // SSID -> BSSID
+    uint32_t                      mGeneration;
+};
+
+}; // namespace android
+
+#endif // _BSS_TABLE_H
@@ -0,0 +1,138 @@
+/*
+   Per access point DHCP lease cache
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "WifiDebug.h"
+#include <utils/Log.h>
+#include "StringUtils.h"
+#include "DhcpLeaseCache.h"
+
+namespace android {
+
+/* One lease per line; the SSID goes last as it may hold spaces, and
+   empty fields are written as "-":
+     bssid expires prefix ipaddr gateway dns1 dns2 server ssid */
+enum { FIELD_BSSID, FIELD_EXPIRES, FIELD_PREFIX, FIELD_IPADDR, FIELD_GATEWAY,
+       FIELD_DNS1, FIELD_DNS2, FIELD_SERVER, FIELD_SSID, FIELD_COUNT };
+
+static String8 fieldValue(const StringSpan& field)
+{
+    if (field.equals("-"))
+        return String8();
+    return field.toString8();
+}
+
+static const char *fieldText(const String8& value)
+{
+    return value.isEmpty() ? "-" : value.string();
+}
+
+DhcpLeaseCache::DhcpLeaseCache(const char *path)
+    : mPath(path)
+{
+}
+
+void DhcpLeaseCache::load()
+{
+    mLeases.clear();
+    FILE *fp = fopen(mPath.string(), "r");
+    if (!fp)
+        return;
+    char line[512];
+    time_t now = time(NULL);
+    while (fgets(line, sizeof(line), fp)) {
+        StringSpan fields[FIELD_COUNT];
+        size_t len = strlen(line);
+        if (len && line[len-1] == '\n')
+            line[--len] = 0;
+        StringTokenizer tokens(line, ' ');
+        int count = 0;
+        while (count < FIELD_SSID && tokens.next(&fields[count]))
+            count++;
+        if (count != FIELD_SSID) {
+            SLOGW("Ignoring malformed lease '%s'\n", line);
+            continue;
+        }
+        // The rest of the line
+        const char *ssid = fields[FIELD_SSID - 1].data + fields[FIELD_SSID - 1].length;
+        if (*ssid)
+            ssid++;
+        fields[FIELD_SSID] = StringSpan(ssid, line + len - ssid);
+        DhcpLease lease;
+        lease.bssid = fieldValue(fields[FIELD_BSSID]);
+        lease.expires = (time_t) strtol(fields[FIELD_EXPIRES].data, NULL, 10);
+        lease.prefixLength = fields[FIELD_PREFIX].toInt();
+        lease.ipaddr = fieldValue(fields[FIELD_IPADDR]);
+        lease.gateway = fieldValue(fields[FIELD_GATEWAY]);
+        lease.dns1 = fieldValue(fields[FIELD_DNS1]);
+        lease.dns2 = fieldValue(fields[FIELD_DNS2]);
+        lease.server = fieldValue(fields[FIELD_SERVER]);
+        lease.ssid = fields[FIELD_SSID].toString8();
+        if (lease.expires > now && !lease.ipaddr.isEmpty())
+            mLeases.add(lease.bssid, lease);
+    }
+    fclose(fp);
+    SLOGV("......Loaded %d DHCP leases\n", (int) mLeases.size());
+}
+
+// Written to a temporary file and renamed, so a crash never leaves half a cache
+void DhcpLeaseCache::save() const
+{
+    String8 temp(mPath);
+    temp.append(".tmp");
+    FILE *fp = fopen(temp.string(), "w");
+    if (!fp) {
+        SLOGW("Unable to write DHCP lease cache %s: %s\n", temp.string(), strerror(errno));
+        return;
+    }
+    for (size_t i = 0 ; i < mLeases.size() ; i++) {
+        const DhcpLease& lease = mLeases.valueAt(i);
+        fprintf(fp, "%s %ld %d %s %s %s %s %s %s\n", fieldText(lease.bssid),
+                (long) lease.expires, lease.prefixLength, fieldText(lease.ipaddr),
+                fieldText(lease.gateway), fieldText(lease.dns1), fieldText(lease.dns2),
+                fieldText(lease.server), lease.ssid.string());
+    }
+    if (fclose(fp) || rename(temp.string(), mPath.string())) {
+        SLOGW("Unable to save DHCP lease cache %s: %s\n", mPath.string(), strerror(errno));
+        unlink(temp.string());
+    }
+}
+
+const DhcpLease *DhcpLeaseCache::find(const String8& ssid, const String8& bssid, int margin) const
+{
+    ssize_t index = mLeases.indexOfKey(bssid);
+    if (index < 0)
+        return NULL;
+    const DhcpLease& lease = mLeases.valueAt(index);
+    if (lease.ssid != ssid || lease.expires - margin <= time(NULL))
+        return NULL;
+    return &lease;
+}
+
+void DhcpLeaseCache::update(const DhcpLease& lease)
+{
+    if (mLeases.indexOfKey(lease.bssid) < 0 && mLeases.size() >= MAX_LEASES) {
+        // Make room by dropping the lease that runs out first
+        size_t oldest = 0;
+        for (size_t i = 1 ; i < mLeases.size() ; i++)
+            if (mLeases.valueAt(i).expires < mLeases.valueAt(oldest).expires)
+                oldest = i;
+        mLeases.removeItemsAt(oldest);
+    }
+    mLeases.add(lease.bssid, lease);
+    save();
+}
+
+void DhcpLeaseCache::remove(const String8& bssid)
+{
+    if (mLeases.removeItem(bssid) >= 0)
+        save();
+}
+
+}; // namespace android
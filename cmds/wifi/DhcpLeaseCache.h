@@ -0,0 +1,44 @@
+/*
+  DHCP leases remembered per access point, so a reconnect to a known
+  BSSID can put the previous address to use before dhcpcd has finished
+  (dhcpcd itself asks for its last address with INIT-REBOOT).
+
+  The cache is kept in a small text file; it belongs to the
+  StateMachine thread.
+ */
+
+#ifndef _DHCP_LEASE_CACHE_H
+#define _DHCP_LEASE_CACHE_H
+
+#include <time.h>
+#include <utils/KeyedVector.h>
+#include <utils/String8.h>
+
+namespace android {
+
+struct DhcpLease {
+    DhcpLease() : prefixLength(0), expires(0) {}
+    String8 ssid, bssid;        // Where the lease was obtained
+    String8 ipaddr, gateway, dns1, dns2, server;
+    int     prefixLength;
+    time_t  expires;            // Wall clock
+};
+
+class DhcpLeaseCache {
+public:
+    enum { MAX_LEASES = 32 };
+    DhcpLeaseCache(const char *path);
+    void     load();
+    // A lease from this access point still valid 'margin' seconds from now
+    const DhcpLease *find(const String8& ssid, const String8& bssid, int margin) const;
+    void     update(const DhcpLease& lease);
+    void     remove(const String8& bssid);
+private:
+    void     save() const;
+    String8                         mPath;
+    KeyedVector<String8, DhcpLease> mLeases;   // By BSSID
+};
+
+}; // namespace android
+
+#endif // _DHCP_LEASE_CACHE_H
@@ -0,0 +1,128 @@
+/*
+   Circular buffer reader for NUL framed lines
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "WifiDebug.h"
+#include <utils/Log.h>
+#include "LineReader.h"
+
+namespace android {
+
+static size_t roundUpPowerOfTwo(size_t size)
+{
+    size_t result = 16;
+    while (result < size)
+        result <<= 1;
+    return result;
+}
+
+LineReader::LineReader(size_t initialSize, size_t maxSize)
+    : mSize(roundUpPowerOfTwo(initialSize))
+    , mMaxSize(roundUpPowerOfTwo(maxSize))
+    , mHead(0), mTail(0), mScanned(0)
+    , mDiscarding(false), mDropped(0)
+{
+    mBuffer = new char[mSize];
+}
+
+LineReader::~LineReader()
+{
+    delete[] mBuffer;
+}
+
+void LineReader::reset()
+{
+    mHead = mTail = mScanned = 0;
+    mDiscarding = false;
+}
+
+// Double the buffer, moving the pending bytes to its start
+void LineReader::grow()
+{
+    size_t used = mTail - mHead;
+    char *buffer = new char[mSize * 2];
+    size_t start = mHead & (mSize - 1);
+    size_t first = used < mSize - start ? used : mSize - start;
+    memcpy(buffer, mBuffer + start, first);
+    memcpy(buffer + first, mBuffer, used - first);
+    delete[] mBuffer;
+    mBuffer = buffer;
+    mSize *= 2;
+    mHead = 0;
+    mTail = used;
+}
+
+ssize_t LineReader::fill(int fd)
+{
+    if (mTail - mHead == mSize) {
+        // Full without a complete line
+        if (mSize < mMaxSize)
+            grow();
+        else {
+            if (!mDiscarding) {
+                SLOGW("Line longer than %d bytes dropped\n", (int) mMaxSize);
+                mDropped++;
+            }
+            mHead = mTail;
+            mScanned = 0;
+            mDiscarding = true;
+        }
+    }
+    size_t free = mSize - (mTail - mHead);
+    size_t start = mTail & (mSize - 1);
+    struct iovec iov[2];
+    iov[0].iov_base = mBuffer + start;
+    iov[0].iov_len = free < mSize - start ? free : mSize - start;
+    iov[1].iov_base = mBuffer;
+    iov[1].iov_len = free - iov[0].iov_len;
+    ssize_t count;
+    do {
+        count = readv(fd, iov, iov[1].iov_len ? 2 : 1);
+    } while (count < 0 && errno == EINTR);
+    if (count > 0)
+        mTail += count;
+    return count;
+}
+
+bool LineReader::next(StringSpan *line)
+{
+    size_t mask = mSize - 1;
+    for (;;) {
+        size_t end = mHead + mScanned;
+        while (end != mTail && mBuffer[end & mask])
+            end++;
+        if (end == mTail) {
+            mScanned = end - mHead;
+            return false;
+        }
+        size_t start = mHead;
+        size_t length = end - start;
+        mHead = end + 1;
+        mScanned = 0;
+        if (mDiscarding) {
+            // The tail of a dropped line
+            mDiscarding = false;
+            continue;
+        }
+        if ((start & mask) + length < mSize)
+            *line = StringSpan(mBuffer + (start & mask), length);
+        else {
+            size_t first = mSize - (start & mask);
+            mWrapped.clear();
+            mWrapped.insertAt(0, 0, length + 1);
+            char *p = mWrapped.editArray();
+            memcpy(p, mBuffer + (start & mask), first);
+            memcpy(p + first, mBuffer, length - first);
+            p[length] = 0;
+            *line = StringSpan(p, length);
+        }
+        return true;
+    }
+}
+
+}; // namespace android
@@ -0,0 +1,55 @@
+/*
+  Framed reader for a stream of NUL terminated lines (the CommandListener
+  protocol).
+
+  Data is read straight into a circular buffer and lines are handed out
+  as views into it, so nothing is copied unless a line wraps around the
+  end of the buffer.  The buffer doubles in size whenever a line does
+  not fit, up to 'maxSize'; longer lines are dropped.
+
+      reader.fill(fd);
+      StringSpan line;
+      while (reader.next(&line))
+          ...
+
+  A view stays valid until the next call to fill(), and is followed by
+  a NUL, so it can be parsed as a C string.
+ */
+
+#ifndef _LINE_READER_H
+#define _LINE_READER_H
+
+#include <sys/types.h>
+#include <utils/Vector.h>
+#include "StringUtils.h"
+
+namespace android {
+
+class LineReader {
+public:
+    LineReader(size_t initialSize = 1024, size_t maxSize = 65536);
+    ~LineReader();
+    // Read what the fd has room for.  Returns the byte count, 0 at end
+    // of file, or -1 on error (errno is set).
+    ssize_t  fill(int fd);
+    // The next complete line, without its terminator
+    bool     next(StringSpan *line);
+    void     reset();
+    size_t   capacity() const { return mSize; }
+    size_t   droppedCount() const { return mDropped; }
+private:
+    void     grow();
+    char    *mBuffer;
+    size_t   mSize;         // Always a power of two
+    size_t   mMaxSize;
+    size_t   mHead;         // Running offsets; the buffer index is
+    size_t   mTail;         //   offset & (mSize - 1)
+    size_t   mScanned;      // Bytes from mHead known to hold no NUL
+    bool     mDiscarding;   // Skipping the rest of an overlong line
+    size_t   mDropped;
+    Vector<char> mWrapped;  // A line that wrapped, made contiguous
+};
+
+}; // namespace android
+
+#endif // _LINE_READER_H
@@ -0,0 +1,42 @@
+/*
+   Process-wide heap allocation counter (host builds only)
+ */
+
+#include <stddef.h>
+#include <cutils/atomic.h>
+#include "MallocCounter.h"
+
+#ifdef __GLIBC__
+extern "C" void *__libc_malloc(size_t);
+extern "C" void *__libc_calloc(size_t, size_t);
+extern "C" void *__libc_realloc(void *, size_t);
+static volatile int32_t sMallocCount;
+extern "C" void *malloc(size_t size)
+{
+    android_atomic_inc(&sMallocCount);
+    return __libc_malloc(size);
+}
+extern "C" void *calloc(size_t count, size_t size)
+{
+    android_atomic_inc(&sMallocCount);
+    return __libc_calloc(count, size);
+}
+extern "C" void *realloc(void *ptr, size_t size)
+{
+    android_atomic_inc(&sMallocCount);
+    return __libc_realloc(ptr, size);
+}
+#endif
+
+namespace android {
+
+int32_t mallocCount()
+{
+#ifdef __GLIBC__
+    return android_atomic_acquire_load(&sMallocCount);
+#else
+    return -1;
+#endif
+}
+
+}; // namespace android
@@ -0,0 +1,21 @@
+/*
+  Heap allocation counter for the host tests and benchmarks.
+
+  Linking MallocCounter.cpp replaces malloc(), calloc() and realloc()
+  for the whole process (every thread and library) with versions that
+  count calls.  Only available with glibc; elsewhere mallocCount()
+  returns -1.
+ */
+
+#ifndef _MALLOC_COUNTER_H
+#define _MALLOC_COUNTER_H
+
+#include <stdint.h>
+
+namespace android {
+
+int32_t mallocCount();
+
+}; // namespace android
+
+#endif // _MALLOC_COUNTER_H
@@ -0,0 +1,200 @@
+/*
+   Lock-free message queue for the StateMachine
+ */
+
+#include <errno.h>
+#include <new>
+#include <sched.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <cutils/atomic.h>
+#include "WifiDebug.h"
+#include <utils/Log.h>
+#include "MessageQueue.h"
+
+namespace android {
+
+// Positions wrap around; compare them as a signed 32 bit difference
+static inline int32_t distance(int32_t a, int32_t b)
+{
+    return static_cast<int32_t>(static_cast<uint32_t>(a) - static_cast<uint32_t>(b));
+}
+
+static inline int32_t advance(int32_t pos, uint32_t count)
+{
+    return static_cast<int32_t>(static_cast<uint32_t>(pos) + count);
+}
+
+AtomicRing::AtomicRing(size_t capacity)
+    : mEnqueuePos(0), mDequeuePos(0)
+{
+    size_t size = 2;
+    while (size < capacity)
+        size <<= 1;
+    mMask = size - 1;
+    mBuffer = new Cell[size];
+    for (size_t i = 0 ; i < size ; i++) {
+        mBuffer[i].sequence = i;
+        mBuffer[i].item = NULL;
+    }
+}
+
+AtomicRing::~AtomicRing()
+{
+    delete[] mBuffer;
+}
+
+bool AtomicRing::push(void *item)
+{
+    Cell *cell;
+    int32_t pos = android_atomic_acquire_load(&mEnqueuePos);
+    while (1) {
+        cell = &mBuffer[pos & mMask];
+        int32_t diff = distance(android_atomic_acquire_load(&cell->sequence), pos);
+        if (diff == 0) {
+            if (!android_atomic_release_cas(pos, advance(pos, 1), &mEnqueuePos))
+                break;
+        } else if (diff < 0)
+            return false;      // Full
+        pos = android_atomic_acquire_load(&mEnqueuePos);
+    }
+    cell->item = item;
+    android_atomic_release_store(advance(pos, 1), &cell->sequence);
+    return true;
+}
+
+void *AtomicRing::pop()
+{
+    Cell *cell;
+    int32_t pos = android_atomic_acquire_load(&mDequeuePos);
+    while (1) {
+        cell = &mBuffer[pos & mMask];
+        int32_t diff = distance(android_atomic_acquire_load(&cell->sequence), advance(pos, 1));
+        if (diff == 0) {
+            if (!android_atomic_release_cas(pos, advance(pos, 1), &mDequeuePos))
+                break;
+        } else if (diff < 0)
+            return NULL;       // Empty
+        pos = android_atomic_acquire_load(&mDequeuePos);
+    }
+    void *item = cell->item;
+    android_atomic_release_store(advance(pos, mMask + 1), &cell->sequence);
+    return item;
+}
+
+bool AtomicRing::isEmpty() const
+{
+    int32_t pos = android_atomic_acquire_load(&mDequeuePos);
+    const Cell *cell = &mBuffer[pos & mMask];
+    return distance(android_atomic_acquire_load(&cell->sequence), advance(pos, 1)) < 0;
+}
+
+// ------------------------------------------------------------
+
+MessageQueue::MessageQueue(size_t lanes, size_t capacity)
+    : mLanes(lanes), mWaiting(0)
+{
+    if (mLanes < 1 || mLanes > MAX_LANES)
+        mLanes = MAX_LANES;
+    for (size_t i = 0 ; i < mLanes ; i++)
+        mRings[i] = new AtomicRing(capacity);
+    mEventFd = eventfd(0, EFD_NONBLOCK);
+    if (mEventFd < 0) {
+        SLOGV("opening message queue eventfd\n");
+        exit(1);
+    }
+}
+
+MessageQueue::~MessageQueue()
+{
+    close(mEventFd);
+    for (size_t i = 0 ; i < mLanes ; i++)
+        delete mRings[i];
+}
+
+bool MessageQueue::push(Message *message, int lane)
+{
+    if (!mRings[lane]->push(message))
+        return false;
+    // Pairs with the barrier in prepareToWait(): either we see the
+    // consumer waiting, or the consumer sees our message.
+    android_memory_barrier();
+    if (android_atomic_acquire_load(&mWaiting)
+     && !android_atomic_release_cas(1, 0, &mWaiting)) {
+        uint64_t one = 1;
+        if (write(mEventFd, &one, sizeof(one)) < 0)
+            SLOGV("writing message queue doorbell");
+    }
+    return true;
+}
+
+bool MessageQueue::prepareToWait()
+{
+    android_atomic_release_store(1, &mWaiting);
+    android_memory_barrier();
+    for (size_t i = 0 ; i < mLanes ; i++)
+        if (!mRings[i]->isEmpty()) {
+            android_atomic_release_store(0, &mWaiting);
+            return false;
+        }
+    return true;
+}
+
+void MessageQueue::acknowledge(bool rung)
+{
+    uint64_t count;
+    android_atomic_release_store(0, &mWaiting);
+    if (rung && read(mEventFd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        SLOGV("reading message queue doorbell");
+}
+
+// ------------------------------------------------------------
+
+MessagePool MessagePool::sPool;
+
+MessagePool::MessagePool()
+    : mFreeSlots(SLOT_COUNT), mSlabAllocs(0), mHeapAllocs(0), mInUse(0)
+{
+    mSlab = new char[SLOT_SIZE * SLOT_COUNT];
+    for (size_t i = 0 ; i < SLOT_COUNT ; i++)
+        mFreeSlots.push(mSlab + i * SLOT_SIZE);
+}
+
+MessagePool::~MessagePool()
+{
+    delete[] mSlab;
+}
+
+void *MessagePool::alloc(size_t size)
+{
+    if (size <= SLOT_SIZE) {
+        void *ptr = sPool.mFreeSlots.pop();
+        if (ptr) {
+            android_atomic_inc(&sPool.mSlabAllocs);
+            android_atomic_inc(&sPool.mInUse);
+            return ptr;
+        }
+    }
+    android_atomic_inc(&sPool.mHeapAllocs);
+    return ::operator new(size);
+}
+
+void MessagePool::free(void *ptr)
+{
+    char *p = static_cast<char *>(ptr);
+    if (p >= sPool.mSlab && p < sPool.mSlab + SLOT_SIZE * SLOT_COUNT) {
+        android_atomic_dec(&sPool.mInUse);
+        sPool.mFreeSlots.push(p);
+    } else
+        ::operator delete(ptr);
+}
+
+void MessagePool::getStats(Stats *stats)
+{
+    stats->slabAllocs = android_atomic_acquire_load(&sPool.mSlabAllocs);
+    stats->heapAllocs = android_atomic_acquire_load(&sPool.mHeapAllocs);
+    stats->inUse = android_atomic_acquire_load(&sPool.mInUse);
+}
+
+}; // namespace android
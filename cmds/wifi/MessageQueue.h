@@ -0,0 +1,97 @@
+/*
+  Message queue and message allocator for the StateMachine.
+
+  The queue is a bounded lock-free ring (Dmitry Vyukov's array queue)
+  that any number of threads may push into.  The StateMachine thread
+  is the only consumer.  A single eventfd acts as a doorbell; producers
+  only write to it when the consumer has announced that it is about to
+  sleep, so a busy state machine drains messages without any syscalls.
+  A queue may have several lanes (rings); the consumer decides which
+  lane to serve next.
+ */
+
+#ifndef _MESSAGE_QUEUE_H
+#define _MESSAGE_QUEUE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+namespace android {
+
+class AtomicRing {
+public:
+    AtomicRing(size_t capacity);   // capacity is rounded up to a power of 2
+    ~AtomicRing();
+    bool  push(void *item);         // returns false if the ring is full
+    void *pop();                    // returns NULL if the ring is empty
+    bool  isEmpty() const;
+    size_t capacity() const { return mMask + 1; }
+private:
+    struct Cell {
+        volatile int32_t sequence;
+        void            *item;
+    };
+    Cell             *mBuffer;
+    uint32_t          mMask;
+    volatile int32_t  mEnqueuePos;
+    volatile int32_t  mDequeuePos;
+};
+
+class Message;
+class MessageQueue {
+public:
+    enum { MAX_LANES = 4 };
+    // Each lane is a separate ring; all lanes share one doorbell
+    MessageQueue(size_t lanes = 1, size_t capacity = 256);
+    ~MessageQueue();
+    bool     push(Message *message, int lane = 0);
+    Message *pop(int lane = 0) { return static_cast<Message *>(mRings[lane]->pop()); }
+    bool     isEmpty(int lane) const { return mRings[lane]->isEmpty(); }
+    size_t   lanes() const { return mLanes; }
+    int      fd() const { return mEventFd; }
+
+    // Consumer side of the doorbell.  Call prepareToWait() before blocking
+    // on fd(); if it returns false there is work pending and the consumer
+    // must not sleep.  Call acknowledge() after waking up, with 'rung' set
+    // if fd() was readable.
+    bool     prepareToWait();
+    void     acknowledge(bool rung);
+private:
+    size_t            mLanes;
+    AtomicRing       *mRings[MAX_LANES];
+    int               mEventFd;
+    volatile int32_t  mWaiting;
+};
+
+/*
+  Fixed-size slab for Message objects.  Free slots are kept in an
+  AtomicRing, so any thread can allocate and the state machine thread
+  recycles them without taking a lock.  Requests that are too big for
+  a slot, or that arrive when the slab is exhausted, go to the heap.
+ */
+class MessagePool {
+public:
+    enum { SLOT_SIZE = 128, SLOT_COUNT = 512 };
+    struct Stats {
+        int32_t slabAllocs;    // Allocations served from the slab
+        int32_t heapAllocs;    // Allocations that fell back to the heap
+        int32_t inUse;         // Slab slots currently allocated
+    };
+    static void *alloc(size_t size);
+    static void  free(void *ptr);
+    static void  getStats(Stats *stats);
+private:
+    MessagePool();
+    ~MessagePool();
+    static MessagePool sPool;
+    char              *mSlab;
+    AtomicRing         mFreeSlots;
+    volatile int32_t   mSlabAllocs;
+    volatile int32_t   mHeapAllocs;
+    volatile int32_t   mInUse;
+};
+
+}; // namespace android
+
+#endif // _MESSAGE_QUEUE_H
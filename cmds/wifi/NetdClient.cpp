@@ -0,0 +1,228 @@
+/*
+   CommandListener (netd) client
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <cutils/sockets.h>
+
+#include "WifiDebug.h"
+#include <utils/Log.h>
+#include "NetdClient.h"
+
+namespace android {
+
+static const int COMMAND_SIZE = 256;
+
+// Parse a decimal field, returning -1 if there is none; '*end' follows it
+static int parseNumber(const char *buf, const char **end)
+{
+    int result = 0;
+    const char *p = buf;
+    while (isdigit(*p))
+        result = result * 10 + (*p++ - '0');
+    *end = p;
+    return (p > buf) ? result : -1;
+}
+
+NetdClient::NetdClient()
+    : mFd(-1), mSequence(0)
+{
+}
+
+NetdClient::~NetdClient()
+{
+    close();
+}
+
+bool NetdClient::open(const char *socket_name)
+{
+    close();
+    mFd = socket_local_client(socket_name, ANDROID_SOCKET_NAMESPACE_RESERVED, SOCK_STREAM);
+    if (mFd < 0) {
+        SLOGW("Could not start connection to socket %s due to error %d\n", socket_name, mFd);
+        mFd = -1;
+        return false;
+    }
+    mReader.reset();
+    return true;
+}
+
+void NetdClient::close()
+{
+    if (mFd < 0)
+        return;
+    ::close(mFd);
+    mFd = -1;
+    failAll();
+}
+
+void NetdClient::subscribe(netd_event_t callback, void *data)
+{
+    Subscriber subscriber;
+    subscriber.callback = callback;
+    subscriber.data = data;
+    mSubscribers.push(subscriber);
+}
+
+int NetdClient::post(netd_reply_t callback, void *data, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    int sequence = vpost(callback, data, fmt, args);
+    va_end(args);
+    return sequence;
+}
+
+int NetdClient::vpost(netd_reply_t callback, void *data, const char *fmt, va_list args)
+{
+    return send(callback, data, NULL, fmt, args);
+}
+
+int NetdClient::send(netd_reply_t callback, void *data, String8 *reply,
+                     const char *fmt, va_list args)
+{
+    char buf[COMMAND_SIZE];
+    if (mFd < 0)
+        return -1;
+    int sequence = ++mSequence;
+    int len = snprintf(buf, sizeof(buf), "%d ", sequence);
+    int count = vsnprintf(buf + len, sizeof(buf) - len, fmt, args);
+    if (count < 0 || count >= (int) sizeof(buf) - len) {
+        SLOGW("Netd command too long: '%s'\n", buf);
+        return -1;
+    }
+    SLOGV(".....Netd:          '%s'\n", buf);
+    if (::write(mFd, buf, len + count + 1) < 0) {
+        SLOGE("Unable to write to netd socket: %s\n", strerror(errno));
+        return -1;
+    }
+    Request request;
+    request.callback = callback;
+    request.data = data;
+    request.reply = reply;
+    mRequests.add(sequence, request);
+    return sequence;
+}
+
+String8 NetdClient::command(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    String8 reply = vcommand(fmt, args);
+    va_end(args);
+    return reply;
+}
+
+String8 NetdClient::vcommand(const char *fmt, va_list args)
+{
+    String8 reply;
+    int sequence = send(NULL, NULL, &reply, fmt, args);
+    if (sequence >= 0)
+        wait(sequence);
+    return reply;
+}
+
+bool NetdClient::wait(int sequence)
+{
+    for (;;) {
+        if (sequence < 0 ? mRequests.isEmpty() : mRequests.indexOfKey(sequence) < 0)
+            return true;
+        struct pollfd pfd;
+        pfd.fd = mFd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        int ret = poll(&pfd, 1, REPLY_TIMEOUT_MSECS);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0) {
+            SLOGW("No reply from netd\n");
+            // A late reply finds no request and is dropped
+            if (sequence < 0)
+                failAll();
+            else
+                complete(mRequests.indexOfKey(sequence), -1, StringSpan());
+            return false;
+        }
+        if (!process())
+            return false;
+    }
+}
+
+bool NetdClient::process()
+{
+    ssize_t count = mReader.fill(mFd);
+    if (count <= 0) {
+        if (count < 0 && errno == EAGAIN)
+            return true;
+        SLOGE("Error reading netd socket: %s\n", count < 0 ? strerror(errno) : "closed");
+        failAll();
+        return false;
+    }
+    StringSpan line;
+    while (mReader.next(&line))
+        dispatch(line);
+    return true;
+}
+
+// "<code> <sequence> <text>" for replies, "<code> <text>" for broadcasts.
+// 'line' is NUL terminated.
+void NetdClient::dispatch(const StringSpan& line)
+{
+    const char *p;
+    int code = parseNumber(line.data, &p);
+    if (code < 0 || *p != ' ') {
+        SLOGW("Malformed netd line '%s'\n", line.data);
+        return;
+    }
+    const char *text = p + 1;
+    const char *end = line.data + line.length;
+    if (code >= 600) {
+        StringSpan event(text, end - text);
+        SLOGV(".....Netd: event '%s'\n", line.data);
+        for (size_t i = 0 ; i < mSubscribers.size() ; i++)
+            mSubscribers[i].callback(code, event, mSubscribers[i].data);
+        return;
+    }
+    int sequence = parseNumber(text, &p);
+    if (sequence < 0 || (*p && *p != ' ')) {
+        SLOGW("Netd reply without a sequence number '%s'\n", line.data);
+        return;
+    }
+    if (*p)
+        p++;
+    SLOGV(".....Netd: resp '%s'\n", line.data);
+    if (code < 200)
+        return;                 // Not the final reply yet
+    ssize_t index = mRequests.indexOfKey(sequence);
+    if (index < 0) {
+        SLOGW("Netd reply for unknown command %d\n", sequence);
+        return;
+    }
+    complete(index, code, StringSpan(p, end - p));
+}
+
+void NetdClient::complete(ssize_t index, int code, const StringSpan& reply)
+{
+    if (index < 0)
+        return;
+    // Removed first, so the callback may post further commands
+    Request request = mRequests.valueAt(index);
+    mRequests.removeItemsAt(index);
+    if (request.reply && code >= 0)
+        request.reply->appendFormat("%d %.*s", code, (int) reply.length, reply.data);
+    if (request.callback)
+        request.callback(code, reply, request.data);
+}
+
+void NetdClient::failAll()
+{
+    while (!mRequests.isEmpty())
+        complete(0, -1, StringSpan());
+}
+
+}; // namespace android
@@ -0,0 +1,84 @@
+/*
+  Client for a CommandListener daemon (netd).
+
+  Every command is tagged with a sequence number and kept in a table
+  until its final (2xx-5xx) reply arrives, so any number of commands can
+  be outstanding; the daemon answers each one with the same number.
+  Unsolicited broadcasts (6xx) carry no sequence number and are handed
+  to the subscribers instead of being mistaken for a reply.
+
+  Lines are parsed in place in the read buffer (see LineReader);
+  callbacks get the code and a view of the text after the code and
+  sequence number, valid only for the duration of the call.
+
+  A NetdClient is not thread safe; it belongs to the StateMachine
+  thread, which calls process() when the socket is readable.
+ */
+
+#ifndef _NETD_CLIENT_H
+#define _NETD_CLIENT_H
+
+#include <stdarg.h>
+#include <utils/Vector.h>
+#include <utils/KeyedVector.h>
+#include <utils/String8.h>
+#include "LineReader.h"
+
+namespace android {
+
+/* Completion of a command; 'code' is -1 if the connection was lost or
+   the reply timed out */
+typedef void (*netd_reply_t)(int code, const StringSpan& reply, void *data);
+// An unsolicited broadcast
+typedef void (*netd_event_t)(int code, const StringSpan& event, void *data);
+
+class NetdClient {
+public:
+    enum { REPLY_TIMEOUT_MSECS = 10000 };
+    NetdClient();
+    ~NetdClient();
+    bool     open(const char *socket_name);
+    void     close();
+    int      fd() const { return mFd; }
+    // Send a command; 'callback' (may be NULL) runs from process() or
+    // wait() with the final reply.  Returns the sequence number, or -1.
+    // Callbacks may post() but must not wait.
+    int      post(netd_reply_t callback, void *data, const char *fmt, ...);
+    int      vpost(netd_reply_t callback, void *data, const char *fmt, va_list args);
+    // Send a command and wait for its final reply, returned as
+    // "<code> <text>".  Other replies and broadcasts that arrive
+    // meanwhile are dispatched as usual.
+    String8  command(const char *fmt, ...);
+    String8  vcommand(const char *fmt, va_list args);
+    // Wait until 'sequence' (or, for -1, every outstanding command) completes
+    bool     wait(int sequence = -1);
+    size_t   outstanding() const { return mRequests.size(); }
+    void     subscribe(netd_event_t callback, void *data);
+    // Read whatever is available and dispatch it.  Returns false if the
+    // connection is lost.
+    bool     process();
+private:
+    struct Request {
+        netd_reply_t callback;
+        void        *data;
+        String8     *reply;     // Filled in for command()
+    };
+    struct Subscriber {
+        netd_event_t callback;
+        void        *data;
+    };
+    int      send(netd_reply_t callback, void *data, String8 *reply,
+                  const char *fmt, va_list args);
+    void     dispatch(const StringSpan& line);
+    void     complete(ssize_t index, int code, const StringSpan& reply);
+    void     failAll();
+    int                         mFd;
+    int                         mSequence;
+    KeyedVector<int, Request>   mRequests;     // Outstanding, by sequence number
+    Vector<Subscriber>          mSubscribers;
+    LineReader                  mReader;
+};
+
+}; // namespace android
+
+#endif // _NETD_CLIENT_H
@@ -0,0 +1,99 @@
+/*
+   Supplicant scan result parsing
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "WifiDebug.h"
+#include <utils/Log.h>
+#include "ScanResults.h"
+
+namespace android {
+
+/* bssid / frequency / signal level / flags / ssid
+   00:19:e3:33:55:2e	2457	-64	[WPA-PSK-TKIP][WPA2-PSK-TKIP+CCMP][ESS]	ADTC
+   00:24:d2:92:7e:e4	2412	-65	[WEP][ESS]	5YPKM
+   00:26:62:50:7e:4a	2462	-89	[WEP][ESS]	HD253 */
+size_t parseScanResults(const char *reply, bss_callback_t callback, void *data)
+{
+    StringTokenizer lines(reply, '\n');
+    StringSpan line;
+    size_t count = 0;
+
+    lines.next(&line);      // The first line is a header
+    while (lines.next(&line)) {
+        StringSpan elements[5];
+        size_t n = splitFields(line, '\t', elements, 5);
+        if (n < 3 || n > 5) {
+            SLOGW("......parseScanResults() Illegal data: %.*s\n", (int) line.length, line.data);
+            continue;
+        }
+        BssRecord bss;
+        bss.bssid = elements[0];
+        bss.frequency = elements[1].toInt();
+        bss.level = elements[2].toInt();
+        if (n == 5) {
+            bss.flags = elements[3];
+            bss.ssid = elements[4];
+        }
+        else if (n == 4) {
+            if (!elements[3].empty() && elements[3].data[0] == '[')
+                bss.flags = elements[3];
+            else
+                bss.ssid = elements[3];
+        }
+        bss.ssid = bss.ssid.trim();
+        callback(bss, data);
+        count++;
+    }
+    return count;
+}
+
+/* id=12
+   bssid=00:19:e3:33:55:2e
+   freq=2457
+   level=-64
+   tsf=0000000123456789
+   flags=[WPA2-PSK-CCMP][ESS]
+   ssid=ADTC
+   ==== */
+size_t parseBssPage(const char *reply, bss_callback_t callback, void *data, int *lastId)
+{
+    StringTokenizer lines(reply, '\n');
+    StringSpan line;
+    BssRecord bss;
+    size_t count = 0;
+
+    while (lines.next(&line)) {
+        if (line.equals("====")) {
+            if (bss.id >= 0) {
+                bss.ssid = bss.ssid.trim();
+                callback(bss, data);
+                *lastId = bss.id;
+                count++;
+            }
+            bss = BssRecord();
+            continue;
+        }
+        const char *p = static_cast<const char *>(memchr(line.data, '=', line.length));
+        if (!p)
+            continue;
+        StringSpan key(line.data, p - line.data);
+        StringSpan value(p + 1, line.data + line.length - (p + 1));
+        if (key.equals("id"))
+            bss.id = value.toInt();
+        else if (key.equals("bssid"))
+            bss.bssid = value;
+        else if (key.equals("freq"))
+            bss.frequency = value.toInt();
+        else if (key.equals("level"))
+            bss.level = value.toInt();
+        else if (key.equals("flags"))
+            bss.flags = value;
+        else if (key.equals("ssid"))
+            bss.ssid = value;
+    }
+    return count;
+}
+
+}; // namespace android
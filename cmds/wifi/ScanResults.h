@@ -0,0 +1,49 @@
+/*
+  Parsing of supplicant scan results.
+
+  SCAN_RESULTS returns the whole table in one reply, which the
+  supplicant cuts off at 4 KB.  From 4.4 the BSS table is read
+  instead, a page at a time:
+
+      BSS RANGE=<first id>- MASK=0x21987
+
+  returns as many complete entries (id, bssid, freq, level, tsf,
+  flags, ssid, each terminated by "====") as fit in a reply; the next
+  page starts after the last id seen, until a page comes back empty.
+
+  Every BSS is handed to a callback as soon as its entry has been
+  parsed, as spans into the reply buffer, so only one page is held at
+  a time and the caller copies out just what it keeps.
+
+  Only parsing lives here; WifiStateMachine issues the commands.
+ */
+
+#ifndef _SCAN_RESULTS_H
+#define _SCAN_RESULTS_H
+
+#include "StringUtils.h"
+
+namespace android {
+
+struct BssRecord {
+    BssRecord() : id(-1), frequency(0), level(0) {}
+    int        id;          // -1 for SCAN_RESULTS lines
+    StringSpan bssid;
+    int        frequency;
+    int        level;
+    StringSpan flags;
+    StringSpan ssid;        // Trimmed; may be empty for hidden networks
+};
+
+typedef void (*bss_callback_t)(const BssRecord& bss, void *data);
+
+// Parse a SCAN_RESULTS reply.  Returns the number of BSSs.
+size_t parseScanResults(const char *reply, bss_callback_t callback, void *data);
+
+// Parse one page of BSS RANGE output.  Returns the number of complete
+// entries; *lastId is set to the id of the last one.
+size_t parseBssPage(const char *reply, bss_callback_t callback, void *data, int *lastId);
+
+}; // namespace android
+
+#endif // _SCAN_RESULTS_H
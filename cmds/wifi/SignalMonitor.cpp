@@ -0,0 +1,44 @@
+/*
+   Adaptive signal polling
+ */
+
+#include <stdlib.h>
+#include "SignalMonitor.h"
+
+namespace android {
+
+static const int NO_SIGNAL = -9999;
+
+SignalMonitor::SignalMonitor()
+{
+    reset();
+}
+
+void SignalMonitor::reset()
+{
+    mLastRssi = NO_SIGNAL;
+    mVariation = 0;
+    mEvents = false;
+}
+
+int SignalMonitor::sample(int rssi, bool fromEvent)
+{
+    if (fromEvent)
+        mEvents = true;
+    if (rssi != NO_SIGNAL && mLastRssi != NO_SIGNAL)
+        mVariation = (mVariation * 3 + abs(rssi - mLastRssi) * 16) / 4;
+    mLastRssi = rssi;
+    return interval();
+}
+
+int SignalMonitor::interval() const
+{
+    if (mLastRssi == NO_SIGNAL)
+        return SLOW_INTERVAL_MSECS;
+    if (abs(mLastRssi - ROAM_THRESHOLD_DBM) <= ROAM_MARGIN_DB
+     || mVariation >= UNSTABLE_DB * 16)
+        return FAST_INTERVAL_MSECS;
+    return mEvents ? EVENT_INTERVAL_MSECS : SLOW_INTERVAL_MSECS;
+}
+
+}; // namespace android
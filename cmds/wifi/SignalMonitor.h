@@ -0,0 +1,39 @@
+/*
+  Chooses how often to poll the signal level of the current connection.
+
+  A steady signal far from the roaming threshold is polled slowly, and
+  more slowly still when the supplicant reports signal changes itself
+  (CTRL-EVENT-SIGNAL-CHANGE).  A signal that moves around, or one close
+  to the threshold where the supplicant starts looking for a better
+  access point, is polled quickly.  With no signal at all there is
+  nothing to follow closely, so polling backs off.
+ */
+
+#ifndef _SIGNAL_MONITOR_H
+#define _SIGNAL_MONITOR_H
+
+namespace android {
+
+class SignalMonitor {
+public:
+    enum { FAST_INTERVAL_MSECS = 1000,
+           SLOW_INTERVAL_MSECS = 8000,
+           EVENT_INTERVAL_MSECS = 30000 };  // Safety net when events arrive
+    enum { ROAM_THRESHOLD_DBM = -75,
+           ROAM_MARGIN_DB = 5,              // "Near" the threshold
+           UNSTABLE_DB = 3 };               // Average change per sample
+    SignalMonitor();
+    // Forget the history, for a new connection
+    void     reset();
+    // Record a signal level; returns the interval to the next poll
+    int      sample(int rssi, bool fromEvent);
+    int      interval() const;
+private:
+    int      mLastRssi;
+    int      mVariation;    // Moving average of the change, in 1/16 dB
+    bool     mEvents;       // The supplicant reports signal changes
+};
+
+}; // namespace android
+
+#endif // _SIGNAL_MONITOR_H
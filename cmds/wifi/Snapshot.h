@@ -0,0 +1,76 @@
+/*
+  Immutable, reference counted snapshots published by one thread and
+  read by any other without a lock.
+
+  The StateMachine thread builds a new value and publish()es it; binder
+  threads call get() and keep the sp<> as long as they like.  Readers
+  never wait: a reader announces itself on the slot it is about to copy
+  and tries again if a publish switched slots underneath it.  The
+  writer fills the slot that is not current, after any reader still
+  copying out of it has finished (a few instructions), and then makes it
+  current.
+
+  Only one thread may publish.
+ */
+
+#ifndef _SNAPSHOT_H
+#define _SNAPSHOT_H
+
+#include <sched.h>
+#include <cutils/atomic.h>
+#include <utils/RefBase.h>
+
+namespace android {
+
+template <class T>
+class Snapshot : public LightRefBase< Snapshot<T> > {
+public:
+    Snapshot(const T& avalue) : value(avalue) {}
+    const T value;
+};
+
+template <class T>
+class Published {
+public:
+    Published() : mCurrent(0) { mReaders[0] = mReaders[1] = 0; }
+
+    // Any thread
+    sp< Snapshot<T> > get() const {
+        for (;;) {
+            int32_t slot = android_atomic_acquire_load(&mCurrent);
+            android_atomic_inc(&mReaders[slot]);
+            // The count must be visible before mCurrent is read again,
+            // or publish() may miss it and refill this slot under us.
+            // Neither the increment nor an acquire load orders a store
+            // before a later load, so this takes a full barrier.
+            android_memory_barrier();
+            if (android_atomic_acquire_load(&mCurrent) == slot) {
+                sp< Snapshot<T> > snapshot = mSlots[slot];
+                android_atomic_dec(&mReaders[slot]);
+                return snapshot;
+            }
+            android_atomic_dec(&mReaders[slot]);
+        }
+    }
+
+    // The publishing thread only
+    void publish(const T& value) {
+        int32_t next = 1 - mCurrent;
+        // Pairs with the barrier in get(): the last publish's store to
+        // mCurrent is visible before the reader counts are read
+        android_memory_barrier();
+        while (android_atomic_acquire_load(&mReaders[next]))
+            sched_yield();
+        mSlots[next] = new Snapshot<T>(value);
+        android_atomic_release_store(next, &mCurrent);
+    }
+
+private:
+    sp< Snapshot<T> >         mSlots[2];
+    volatile int32_t          mCurrent;
+    mutable volatile int32_t  mReaders[2];
+};
+
+}; // namespace android
+
+#endif // _SNAPSHOT_H
@@ -3,32 +3,354 @@
    State Machine logic
  */
 
-#include <sys/socket.h>
+#include <errno.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <cutils/atomic.h>
 #include "WifiDebug.h"
 #include "StateMachine.h"
 
 namespace android {
 
-StateMachine::StateMachine() : mCurrentState(0), mTargetState(0)
+// A timer may wait this long for later ones to share its wakeup
+static const nsecs_t TIMER_COALESCE_SLACK = ms2ns(10);
+static const int MAX_EPOLL_EVENTS = 8;
+// Messages each lane may take per scheduling round, highest lane first
+static const int LANE_WEIGHT[StateMachine::LANE_COUNT] = { 8, 4, 2, 1 };
+
+void Message::setString(const char *str)
+{
+    if (!str)
+        str = "";
+    strncpy(mString, str, sizeof(mString) - 1);
+    mString[sizeof(mString) - 1] = 0;
+}
+
+void *Message::operator new(size_t size)
+{
+    return MessagePool::alloc(size);
+}
+
+void Message::operator delete(void *ptr)
+{
+    MessagePool::free(ptr);
+}
+
+// ------------------------------------------------------------
+class StateMachineWorker : public Thread {
+public:
+    StateMachineWorker(StateMachine *machine) : Thread(false), mMachine(machine) {}
+    void submit(job_callback_t callback, void *data, int arg) {
+        Job job;
+        job.callback = callback;
+        job.data = data;
+        job.arg = arg;
+        Mutex::Autolock _l(mLock);
+        mJobs.push(job);
+        mCondition.signal();
+    }
+    void stop() {
+        {
+            Mutex::Autolock _l(mLock);
+            requestExit();
+            mCondition.signal();
+        }
+        requestExitAndWait();
+    }
+private:
+    struct Job {
+        job_callback_t callback;
+        void          *data;
+        int            arg;
+    };
+    virtual bool threadLoop() {
+        Job job;
+        {
+            Mutex::Autolock _l(mLock);
+            while (mJobs.size() == 0 && !exitPending())
+                mCondition.wait(mLock);
+            if (exitPending())
+                return false;
+            job = mJobs[0];
+            mJobs.removeAt(0);
+        }
+        Message *message = job.callback(job.data, job.arg);
+        if (message)
+            mMachine->enqueue(message);
+        return true;
+    }
+    StateMachine *mMachine;
+    Mutex         mLock;
+    Condition     mCondition;
+    Vector<Job>   mJobs;
+};
+
+class StateMachineWatchdog : public Thread {
+public:
+    StateMachineWatchdog(StateMachine *machine) : Thread(false), mMachine(machine) {}
+    void stop() {
+        {
+            Mutex::Autolock _l(mLock);
+            requestExit();
+            mCondition.signal();
+        }
+        requestExitAndWait();
+    }
+private:
+    virtual bool threadLoop() {
+        int budget = mMachine->checkHandler();
+        Mutex::Autolock _l(mLock);
+        if (!exitPending())
+            mCondition.waitRelative(mLock, ms2ns(budget > 0 ? (budget + 1) / 2 : 1000));
+        return !exitPending();
+    }
+    StateMachine *mMachine;
+    Mutex         mLock;
+    Condition     mCondition;
+};
+
+// ------------------------------------------------------------
+StateMachine::StateMachine()
+    : mCurrentState(0), mTargetState(0), mThreadId(0), mQueue(LANE_COUNT)
+    , mCoalesced(0), mDeferedRedispatches(0), mTimers(TIMER_COALESCE_SLACK)
+    , mTraceCount(0), mDispatchSerial(0), mDispatchCommand(0), mDispatchState(0)
+    , mDispatchStart(0), mReportedSerial(0), mHandlerBudget(0), mWatchdogReports(0)
 {
-    extraFd = -1;
-    if (socketpair(AF_UNIX, SOCK_STREAM, 0, xsockets) < 0) {
-        SLOGV("opening stream socket pair\n");
+    memset(mCoalesceSlots, 0, sizeof(mCoalesceSlots));
+    memset(mTrace, 0, sizeof(mTrace));
+    for (int i = 0 ; i < LANE_COUNT ; i++) {
+        mLaneCredits[i] = LANE_WEIGHT[i];
+        mLaneStarvation[i] = 0;
+    }
+    struct epoll_event ev;
+    mEpollFd = epoll_create(MAX_EPOLL_EVENTS);
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = mQueue.fd();
+    if (mEpollFd < 0 || epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mQueue.fd(), &ev) < 0) {
+        SLOGV("opening state machine epoll instance\n");
         exit(1);
     }
 }
 
+StateMachine::~StateMachine()
+{
+    if (mWorker != NULL)
+        mWorker->stop();
+    if (mWatchdog != NULL)
+        mWatchdog->stop();
+}
+
+void StateMachine::submit(job_callback_t job, void *data, int arg)
+{
+    Mutex::Autolock _l(mHelperLock);
+    if (mWorker == NULL) {
+        mWorker = new StateMachineWorker(this);
+        mWorker->run("StateMachineWorker", PRIORITY_NORMAL);
+    }
+    mWorker->submit(job, data, arg);
+}
+
+void StateMachine::setHandlerBudget(int msecs)
+{
+    Mutex::Autolock _l(mHelperLock);
+    android_atomic_release_store(msecs, &mHandlerBudget);
+    if (msecs > 0 && mWatchdog == NULL) {
+        mWatchdog = new StateMachineWatchdog(this);
+        mWatchdog->run("StateMachineWatchdog", PRIORITY_BACKGROUND);
+    }
+}
+
+/* Reports the running handler, once, if it has overrun its budget.
+   Returns the budget so the watchdog knows how often to look. */
+int StateMachine::checkHandler()
+{
+    int budget = android_atomic_acquire_load(&mHandlerBudget);
+    int32_t serial = android_atomic_acquire_load(&mDispatchSerial);
+    if (budget <= 0 || !(serial & 1) || serial == mReportedSerial)
+        return budget;
+    int32_t command = mDispatchCommand;
+    int32_t state = mDispatchState;
+    // Unsigned, so the difference is right across the 32 bit wrap
+    int32_t elapsed = static_cast<int32_t>(static_cast<uint32_t>(ns2ms(systemTime())) - mDispatchStart);
+    android_memory_barrier();
+    if (android_atomic_acquire_load(&mDispatchSerial) != serial || elapsed <= budget)
+        return budget;
+    mReportedSerial = serial;
+    android_atomic_inc(&mWatchdogReports);
+    SLOGW("Handler for %s (%d) in state %s has been running for %d ms\n",
+          msgStr(command), command, stateStr(state), elapsed);
+    return budget;
+}
+
+int StateMachine::addFd(int fd, int events, fd_callback_t callback, void *data)
+{
+    struct epoll_event ev;
+    FdHandler handler;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.fd = fd;
+    handler.callback = callback;
+    handler.data = data;
+    int op = (mFdHandlers.indexOfKey(fd) >= 0) ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    if (epoll_ctl(mEpollFd, op, fd, &ev) < 0) {
+        SLOGW("......addFd: unable to watch fd %d errno %d\n", fd, errno);
+        return -1;
+    }
+    mFdHandlers.replaceValueFor(fd, handler);
+    return 0;
+}
+
+void StateMachine::removeFd(int fd)
+{
+    if (mFdHandlers.removeItem(fd) >= 0)
+        epoll_ctl(mEpollFd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+static void lockSlot(volatile int32_t *lock)
+{
+    while (android_atomic_acquire_cas(0, 1, lock))
+        sched_yield();
+}
+
+static void unlockSlot(volatile int32_t *lock)
+{
+    android_atomic_release_store(0, lock);
+}
+
+/* Returns true if the message was folded into an instance that is
+   already queued (and has been deleted). */
+bool StateMachine::coalesce(Message *message)
+{
+    int command = message->command();
+    if (command < 0 || command >= MAX_COALESCED_COMMAND)
+        return false;
+    int mode = coalesceMode(command);
+    if (mode == COALESCE_NONE)
+        return false;
+    CoalesceSlot& slot = mCoalesceSlots[command];
+    lockSlot(&slot.lock);
+    if (!slot.message) {
+        slot.message = message;
+        slot.arg1 = message->arg1();
+        slot.arg2 = message->arg2();
+        unlockSlot(&slot.lock);
+        return false;
+    }
+    if (mode == COALESCE_REPLACE)
+        coalesceArgs(command, &slot.arg1, &slot.arg2, message);
+    unlockSlot(&slot.lock);
+    android_atomic_inc(&mCoalesced);
+    delete message;
+    return true;
+}
+
+/* Called when a message leaves the queue: from here on a new instance
+   of the command is queued again rather than merged. */
+void StateMachine::claimCoalesced(Message *message)
+{
+    int command = message->command();
+    if (command < 0 || command >= MAX_COALESCED_COMMAND)
+        return;
+    CoalesceSlot& slot = mCoalesceSlots[command];
+    if (!slot.message)
+        return;
+    lockSlot(&slot.lock);
+    if (slot.message == message) {
+        message->mArg1 = slot.arg1;
+        message->mArg2 = slot.arg2;
+        slot.message = NULL;
+    }
+    unlockSlot(&slot.lock);
+}
+
 void StateMachine::enqueue(Message *message)
 {
-    if (write(xsockets[1], &message, sizeof(message)) < 0)
-        SLOGV("writing stream message");
+    if (coalesce(message))
+        return;
+    int lane = messageLane(message);
+    if (lane < 0 || lane >= LANE_COUNT)
+        lane = LANE_INTERNAL;
+    while (!mQueue.push(message, lane)) {
+        // The queue is full.  Our own thread can't wait for itself to
+        // drain it, so park the message on the overflow list instead.
+        if (androidGetThreadId() == mThreadId) {
+            mOverflowMessages[lane].push(message);
+            return;
+        }
+        sched_yield();
+    }
+}
+
+// Only called on the state machine thread
+void StateMachine::queueLocal(Message *message)
+{
+    int lane = messageLane(message);
+    if (lane < 0 || lane >= LANE_COUNT)
+        lane = LANE_INTERNAL;
+    if (!mQueue.push(message, lane))
+        mOverflowMessages[lane].push(message);
+}
+
+Message *StateMachine::popLane(int lane)
+{
+    Message *message = mQueue.pop(lane);
+    if (!message && mOverflowMessages[lane].size() > 0) {
+        message = mOverflowMessages[lane][0];
+        mOverflowMessages[lane].removeAt(0);
+    }
+    return message;
+}
+
+bool StateMachine::laneHasWork(int lane) const
+{
+    return !mQueue.isEmpty(lane) || mOverflowMessages[lane].size() > 0;
+}
+
+/* Weighted round robin: the highest lane that still has credit in this
+   round is served.  Once every lane with work has used its credit, a new
+   round starts. */
+Message *StateMachine::nextQueued()
+{
+    for (int round = 0 ; round < 2 ; round++) {
+        for (int lane = 0 ; lane < LANE_COUNT ; lane++) {
+            if (!mLaneCredits[lane])
+                continue;
+            Message *message = popLane(lane);
+            if (!message)
+                continue;
+            mLaneCredits[lane]--;
+            for (int other = 0 ; other < LANE_COUNT ; other++)
+                if (other != lane && laneHasWork(other))
+                    mLaneStarvation[other]++;
+            return message;
+        }
+        for (int lane = 0 ; lane < LANE_COUNT ; lane++)
+            mLaneCredits[lane] = LANE_WEIGHT[lane];
+    }
+    return NULL;
+}
+
+int StateMachine::enqueueDelayed(Message *message, int delay)
+{
+    return mTimers.add(message, systemTime() + ms2ns(delay));
+}
+
+int StateMachine::replaceDelayed(int command, int delay)
+{
+    mTimers.cancelCommand(command);
+    return enqueueDelayed(command, delay);
 }
 
-void StateMachine::enqueueDelayed(int command, int delay)
+bool StateMachine::cancelDelayed(int handle)
 {
-    Message *message = new Message(command);
-    message->mExecuteTime = systemTime() + ms2ns(delay);
-    mDelayedMessages.push(message);
+    return mTimers.cancel(handle);
+}
+
+int StateMachine::removeDelayed(int command)
+{
+    return mTimers.cancelCommand(command);
 }
 
 void StateMachine::transitionTo(int key)
@@ -42,46 +364,157 @@ void StateMachine::transitionTo(int key)
         SLOGV("....ERROR: state %d doesn't have a value\n", key);
 }
 
-bool StateMachine::threadLoop()
+Message *StateMachine::nextMessage()
 {
-    fd_set readfds;
-    struct timeval tv;
+    struct epoll_event events[MAX_EPOLL_EVENTS];
 
-    FD_ZERO(&readfds);
-    while (!exitPending()) {
-        Message *message = NULL;
-        mCurrentState = mTargetState;
-        while (mDeferedMessages.size() > 0) {
-            Message *m = mDeferedMessages[0];
-            mDeferedMessages.removeAt(0);
-            enqueue(m);
+    while (1) {
+        if (mFrontMessages.size() > 0) {
+            Message *message = mFrontMessages[0];
+            mFrontMessages.removeAt(0);
+            return message;
+        }
+        // Timers that are due join their lane like any other message
+        nsecs_t now = systemTime();
+        Message *message;
+        while ((message = mTimers.expired(now)) != NULL)
+            queueLocal(message);
+        message = nextQueued();
+        if (message) {
+            claimCoalesced(message);
+            return message;
+        }
+        if (!mQueue.prepareToWait())
+            continue;
+        int timeout = -1;
+        nsecs_t deadline = mTimers.nextDeadline();
+        if (deadline >= 0)
+            timeout = toMillisecondTimeoutDelay(systemTime(), deadline);
+        int count = epoll_wait(mEpollFd, events, MAX_EPOLL_EVENTS, timeout);
+        bool rung = false;
+        if (count < 0 && errno != EINTR)
+            SLOGV("error in epoll_wait %d\n", errno);
+        for (int i = 0 ; i < count ; i++) {
+            int fd = events[i].data.fd;
+            if (fd == mQueue.fd()) {
+                rung = true;
+                continue;
+            }
+            // An earlier callback in this batch may have removed the fd
+            ssize_t index = mFdHandlers.indexOfKey(fd);
+            if (index < 0)
+                continue;
+            FdHandler handler = mFdHandlers.valueAt(index);
+            if (!handler.callback(fd, events[i].events, handler.data))
+                removeFd(fd);
         }
-        while (!message) {
-            int nfd = xsockets[0] + 1;
-            FD_SET(xsockets[0], &readfds);
-            if (extraFd != -1) {
-                FD_SET(extraFd, &readfds);
-                if (extraFd >= nfd)
-                    nfd = extraFd + 1;
+        mQueue.acknowledge(rung);
+    }
+}
+
+// Called only on the state machine thread
+void StateMachine::trace(nsecs_t when, nsecs_t duration, int command,
+                         int from, int to, stateprocess_t result)
+{
+    int32_t index = mTraceCount;
+    TraceEntry& entry = mTrace[index % TRACE_SIZE];
+    android_atomic_release_store(2 * index + 1, &entry.sequence);
+    android_memory_barrier();
+    entry.when = when;
+    entry.duration = duration / 1000;
+    entry.command = command;
+    entry.from = from;
+    entry.to = to;
+    entry.result = result;
+    android_atomic_release_store(2 * index + 2, &entry.sequence);
+    android_atomic_release_store(index + 1, &mTraceCount);
+}
+
+static const char *resultStr(int result)
+{
+    switch (result) {
+    case SM_DEFAULT: return "DEFAULT";
+    case SM_HANDLED: return "HANDLED";
+    case SM_NOT_HANDLED: return "NOT_HANDLED";
+    case SM_DEFER: return "DEFER";
+    }
+    return "?";
+}
+
+void StateMachine::dumpTrace(String8& out)
+{
+    // Per command totals over the entries in the ring
+    KeyedVector<int, int> counts;
+    KeyedVector<int, int64_t> totals, maxima;
+    nsecs_t now = systemTime();
+    int32_t count = android_atomic_acquire_load(&mTraceCount);
+    int32_t first = count > TRACE_SIZE ? count - TRACE_SIZE : 0;
+
+    out.appendFormat("State machine trace (last %d of %d messages, times in seconds from now):\n", count - first, count);
+    for (int32_t index = first ; index < count ; index++) {
+        TraceEntry& slot = mTrace[index % TRACE_SIZE];
+        TraceEntry entry;
+        int32_t sequence = android_atomic_acquire_load(&slot.sequence);
+        entry.when = slot.when;
+        entry.duration = slot.duration;
+        entry.command = slot.command;
+        entry.from = slot.from;
+        entry.to = slot.to;
+        entry.result = slot.result;
+        android_memory_barrier();
+        if (sequence != 2 * index + 2 || slot.sequence != sequence)
+            continue;       // Overwritten while we were reading it
+        out.appendFormat("  %10.6f %s(%d) %s -> %s %s %dus\n",
+                         (entry.when - now) / 1e9, msgStr(entry.command), entry.command,
+                         stateStr(entry.from), stateStr(entry.to),
+                         resultStr(entry.result), entry.duration);
+        ssize_t i = counts.indexOfKey(entry.command);
+        if (i < 0) {
+            counts.add(entry.command, 1);
+            totals.add(entry.command, entry.duration);
+            maxima.add(entry.command, entry.duration);
+        } else {
+            counts.editValueAt(i)++;
+            totals.editValueAt(i) += entry.duration;
+            if (maxima.valueAt(i) < entry.duration)
+                maxima.editValueAt(i) = entry.duration;
+        }
+    }
+    out.append("Handler time by message (us):\n");
+    for (size_t i = 0 ; i < counts.size() ; i++)
+        out.appendFormat("  %-32s count %4d avg %8lld max %8lld\n", msgStr(counts.keyAt(i)),
+                         counts.valueAt(i), (long long)(totals.valueAt(i) / counts.valueAt(i)),
+                         (long long)maxima.valueAt(i));
+}
+
+bool StateMachine::threadLoop()
+{
+    mThreadId = androidGetThreadId();
+    while (!exitPending()) {
+        /* As in StateMachine.java, defered messages are only retried
+           after a state change, ahead of everything else in the queue
+           and in their original order. */
+        if (mTargetState != mCurrentState) {
+            mCurrentState = mTargetState;
+            if (mDeferedMessages.size() > 0) {
+                mDeferedRedispatches += mDeferedMessages.size();
+                mFrontMessages.insertVectorAt(mDeferedMessages, 0);
+                mDeferedMessages.clear();
             }
-            tv.tv_sec = 2;
-            tv.tv_usec = 100000;
-            int rv = select(nfd, &readfds, NULL, NULL, &tv);
-            //SLOGV("after Select %d errno %d isset %d\n", rv, errno, FD_ISSET(xsockets[0], &readfds));
-            if (rv == -1)
-                SLOGV("error in select select"); // error occurred in select()
-            else if (rv == 0 && mDelayedMessages.size()
-             &&  mDelayedMessages[0]->mExecuteTime < systemTime()) {
-                message = mDelayedMessages[0];
-                mDelayedMessages.removeAt(0);
-            } else if (rv > 0 && FD_ISSET(xsockets[0], &readfds)) {
-                if (read(xsockets[0], &message, sizeof(message)) < 0)
-                    SLOGV("error reading stream message\n");
-            } else if (rv > 0 && extraFd != -1 && FD_ISSET(extraFd, &readfds))
-                extraCb();
         }
+        // Drain everything that is queued before going back to sleep
+        Message *message = nextMessage();
         const char *msg_str = msgStr(message->command());
-        switch (invoke_process(mCurrentState, message)) {
+        int command = message->command();
+        nsecs_t start = systemTime();
+        mDispatchCommand = command;
+        mDispatchState = mCurrentState;
+        mDispatchStart = static_cast<uint32_t>(ns2ms(start));
+        android_atomic_release_store(mDispatchSerial + 1, &mDispatchSerial);
+        stateprocess_t result = invoke_process(mCurrentState, message);
+        android_atomic_release_store(mDispatchSerial + 1, &mDispatchSerial);
+        trace(start, systemTime() - start, command, mCurrentState, mTargetState, result);
+        switch (result) {
         case SM_DEFER:
             SLOGV(".......Message %s (%d) is being defered by current state\n", msg_str, message->command());
             mDeferedMessages.push(message);
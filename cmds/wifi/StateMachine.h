@@ -10,48 +10,163 @@
 #include <utils/KeyedVector.h>
 #include <utils/String8.h>
 #include <utils/threads.h>
+#include "MessageQueue.h"
+#include "TimerQueue.h"
 
 namespace android {
 class StateMachine;
 class Message {
 public:
-    Message(int command, int arg1 = -1, int arg2 = -1, const String8& str=String8()) 
-	: mCommand(command), mArg1(arg1), mArg2(arg2), mString(str) {}
+    enum { MAX_STRING = 48 };   // Holds a BSSID or MAC address inline
+    Message(int command, int arg1 = -1, int arg2 = -1, const char *str = NULL)
+	: mCommand(command), mArg1(arg1), mArg2(arg2) { setString(str); }
     virtual ~Message() {}
     int command() const { return mCommand; }
     int arg1() const { return mArg1; }
     int arg2() const { return mArg2; }
-    const String8& string() const { return mString; }
-    nsecs_t        mExecuteTime;  // Only for delayed messages
+    const char *string() const { return mString; }
+    // Messages (and small subclasses) are carved out of MessagePool
+    static void *operator new(size_t size);
+    static void  operator delete(void *ptr);
 private:
+    friend class StateMachine;
+    void           setString(const char *str);
     int            mCommand;
     int            mArg1, mArg2;
-    String8        mString;
+    char           mString[MAX_STRING];
 };
 
 enum stateprocess_t { SM_DEFAULT, SM_HANDLED, SM_NOT_HANDLED, SM_DEFER };
 
+/* Called on the state machine thread when a registered fd is ready.
+   'events' is the EPOLLxxx mask.  Return 0 to unregister the fd. */
+typedef int (*fd_callback_t)(int fd, int events, void *data);
+
+/* Blocking work, run on the state machine's worker thread.  The message
+   returned (if any) is enqueued on the state machine as the completion. */
+typedef Message *(*job_callback_t)(void *data, int arg);
+
+class StateMachineWorker;
+class StateMachineWatchdog;
 class StateMachine : public Thread {
 public:
     enum { CMD_TERMINATE = -1 };
+    // Priority lanes, highest first.  Lanes are served by weighted round
+    // robin so a busy lane cannot starve the ones below it.
+    enum { LANE_HARDWARE, LANE_INTERNAL, LANE_CLIENT, LANE_HOUSEKEEPING, LANE_COUNT };
+    // How enqueue() treats a command that is already queued
+    enum { COALESCE_NONE,       // Queue every instance
+           COALESCE_DROP,       // Drop the new instance
+           COALESCE_REPLACE };  // Merge the new arguments into the queued one
+    enum { MAX_COALESCED_COMMAND = 64 };
     StateMachine();
-    virtual ~StateMachine() {}
+    virtual ~StateMachine();
     void transitionTo(int);
     void enqueue(Message *);
     void enqueue(int command) { enqueue(new Message(command)); }
-    void enqueueDelayed(int command, int delay);
+    // Delayed messages may only be managed from the state machine thread
+    int  enqueueDelayed(Message *, int delay);     // Returns a timer handle
+    int  enqueueDelayed(int command, int delay) { return enqueueDelayed(new Message(command), delay); }
+    int  replaceDelayed(int command, int delay);   // Drops pending timers for command
+    bool cancelDelayed(int handle);
+    int  removeDelayed(int command);
+    // File descriptors may be (un)registered from the state machine
+    // thread, or from any thread before the state machine starts running
+    int  addFd(int fd, int events, fd_callback_t callback, void *data);
+    void removeFd(int fd);
+    // Number of defered messages handed back to a new state so far
+    size_t deferedRedispatchCount() const { return mDeferedRedispatches; }
+    // Times a lane had messages waiting while another lane was served
+    size_t laneStarvationCount(int lane) const { return mLaneStarvation[lane]; }
+    // Messages dropped or merged by coalescing
+    int32_t coalescedCount() const { return mCoalesced; }
+    // Append the recent dispatch trace to 'out'.  Safe from any thread.
+    void dumpTrace(String8& out);
+    // Jobs run one at a time on a single worker thread, in submission order
+    void submit(job_callback_t job, void *data, int arg = 0);
+    // Log any handler that runs longer than 'msecs' (0 turns this off)
+    void setHandlerBudget(int msecs);
+    int32_t watchdogReportCount() const { return mWatchdogReports; }
     virtual stateprocess_t invoke_process(int, Message *) = 0;
 protected:
     virtual const char *msgStr(int msg_id) { return ""; }
-    int               extraFd;
-    void              (*extraCb)(void);
+    virtual const char *stateStr(int state) { return ""; }
+    // Lane for a message.  Called on the enqueueing thread.
+    virtual int messageLane(const Message *message) const { return LANE_INTERNAL; }
+    // Coalescing mode for a command (below MAX_COALESCED_COMMAND).
+    // Called on the enqueueing thread.
+    virtual int coalesceMode(int command) const { return COALESCE_NONE; }
+    // COALESCE_REPLACE: merge an incoming instance into the queued
+    // arguments.  The default keeps the newest arguments.
+    virtual void coalesceArgs(int command, int *arg1, int *arg2,
+                              const Message *incoming) const {
+        *arg1 = incoming->arg1();
+        *arg2 = incoming->arg2();
+    }
 private:
+    struct FdHandler {
+        fd_callback_t callback;
+        void         *data;
+    };
+    /* One dispatch in the trace ring.  Written only by the state machine
+       thread; 'sequence' is odd while the entry is being written. */
+    enum { TRACE_SIZE = 256 };
+    struct TraceEntry {
+        volatile int32_t sequence;
+        int32_t          duration;     // Microseconds in invoke_process
+        nsecs_t          when;         // Dispatch start, SYSTEM_TIME_MONOTONIC
+        int16_t          command;
+        uint8_t          from, to;     // States before and after
+        uint8_t          result;       // stateprocess_t
+    };
+    // The queued instance of a coalesced command, guarded by a spin lock
+    struct CoalesceSlot {
+        volatile int32_t lock;
+        Message         *message;
+        int              arg1, arg2;
+    };
+
     virtual bool      threadLoop();
+    Message          *nextMessage();
+    Message          *nextQueued();
+    Message          *popLane(int lane);
+    bool              laneHasWork(int lane) const;
+    void              queueLocal(Message *message);
+    bool              coalesce(Message *message);
+    void              claimCoalesced(Message *message);
+    void              trace(nsecs_t when, nsecs_t duration, int command,
+                            int from, int to, stateprocess_t result);
+    friend class StateMachineWatchdog;
+    int               checkHandler();    // Called by the watchdog
     int               mCurrentState;
     int               mTargetState;
-    int               xsockets[2];
+    android_thread_id_t mThreadId;
+    MessageQueue      mQueue;
+    int               mEpollFd;
+    KeyedVector<int, FdHandler> mFdHandlers;
+    Vector<Message *> mOverflowMessages[LANE_COUNT];  // Only touched by our own thread
+    int               mLaneCredits[LANE_COUNT];
+    size_t            mLaneStarvation[LANE_COUNT];
+    CoalesceSlot      mCoalesceSlots[MAX_COALESCED_COMMAND];
+    volatile int32_t  mCoalesced;
+    Vector<Message *> mFrontMessages;     // Dispatched before the queue
     Vector<Message *> mDeferedMessages;
-    Vector<Message *> mDelayedMessages;
+    size_t            mDeferedRedispatches;
+    TimerQueue        mTimers;
+    TraceEntry        mTrace[TRACE_SIZE];
+    volatile int32_t  mTraceCount;        // Entries ever written
+    // The handler being run, for the watchdog; mDispatchSerial is odd
+    // while invoke_process() is running
+    volatile int32_t  mDispatchSerial;
+    int32_t           mDispatchCommand;
+    int32_t           mDispatchState;
+    uint32_t          mDispatchStart;     // Milliseconds, SYSTEM_TIME_MONOTONIC, wraps
+    int32_t           mReportedSerial;    // Only touched by the watchdog
+    volatile int32_t  mHandlerBudget;
+    volatile int32_t  mWatchdogReports;
+    Mutex             mHelperLock;        // Guards starting the helper threads
+    sp<StateMachineWorker>   mWorker;
+    sp<StateMachineWatchdog> mWatchdog;
 };
 }; // namespace android
 
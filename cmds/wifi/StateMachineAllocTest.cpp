@@ -0,0 +1,120 @@
+/*
+   Host test: the StateMachine hot path does not touch the heap.
+
+   Feeds a steady stream of supplicant events (plain messages and ones
+   carrying a BSSID) while RSSI poll timers re-arm themselves on the
+   state machine thread.  After a warm-up, which lets the queue rings,
+   the timer heap and the message slab reach their working size, no
+   message may cause a heap allocation and none may fall back from
+   MessagePool to the heap.  Exits non-zero on failure.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <cutils/atomic.h>
+#include "WifiDebug.h"
+#include <utils/Log.h>
+#include "StateMachine.h"
+#include "wifistates.h"
+#include "MallocCounter.h"
+
+namespace android {
+
+class AllocTestMachine : public StateMachine {
+public:
+    enum { POLL_CHAINS = 8 };
+    AllocTestMachine() : mHandled(0) {}
+    int32_t handled() const { return android_atomic_acquire_load(&mHandled); }
+    void stop() {
+        requestExit();
+        enqueue(EVENT_NONE);
+        requestExitAndWait();
+    }
+    virtual stateprocess_t invoke_process(int state, Message *message) {
+        switch (message->command()) {
+        case CMD_ENABLE_RSSI_POLL:
+            for (int i = 0 ; i < POLL_CHAINS ; i++)
+                enqueueDelayed(new Message(CMD_RSSI_POLL, i), 1 + i);
+            break;
+        case CMD_RSSI_POLL:
+            if (!exitPending())
+                enqueueDelayed(new Message(CMD_RSSI_POLL, message->arg1()), 1 + message->arg1());
+            break;
+        default:
+            android_atomic_inc(&mHandled);
+            break;
+        }
+        return SM_HANDLED;
+    }
+protected:
+    virtual int messageLane(const Message *message) const {
+        return message->command() == CMD_RSSI_POLL ? LANE_HOUSEKEEPING : LANE_HARDWARE;
+    }
+private:
+    volatile int32_t mHandled;
+};
+
+/* Send 'count' supplicant events in bursts, waiting for each burst to
+   be handled so the slab is never exhausted */
+static void supplicantEvents(AllocTestMachine *machine, int count)
+{
+    static const int BURST = 32;
+    int32_t target = machine->handled();
+    for (int sent = 0 ; sent < count ; ) {
+        for (int i = 0 ; i < BURST && sent < count ; i++, sent++) {
+            switch (sent % 4) {
+            case 0:
+                machine->enqueue(new Message(SUP_STATE_CHANGE_EVENT, 0, 7));
+                break;
+            case 1:
+                machine->enqueue(new Message(ASSOCIATED_WITH_EVENT, -1, -1, "00:19:e3:01:02:2e"));
+                break;
+            case 2:
+                machine->enqueue(new Message(CTRL_EVENT_SIGNAL_CHANGE, -60, 54));
+                break;
+            default:
+                machine->enqueue(CTRL_EVENT_LINK_SPEED);
+                break;
+            }
+            target++;
+        }
+        while (machine->handled() < target)
+            usleep(100);
+    }
+}
+
+}; // namespace android
+
+using namespace android;
+
+int main(int argc, char **argv)
+{
+    static const int WARMUP = 20000, MESSAGES = 200000;
+    sp<AllocTestMachine> machine = new AllocTestMachine();
+    machine->run("wifi_alloc_test");
+    machine->enqueue(CMD_ENABLE_RSSI_POLL);
+    supplicantEvents(machine.get(), WARMUP);
+
+    MessagePool::Stats before, after;
+    MessagePool::getStats(&before);
+    int32_t mallocs = mallocCount();
+    supplicantEvents(machine.get(), MESSAGES);
+    mallocs = mallocCount() - mallocs;
+    MessagePool::getStats(&after);
+    int32_t slab = after.slabAllocs - before.slabAllocs;
+    int32_t fallbacks = after.heapAllocs - before.heapAllocs;
+    machine->stop();
+
+    printf("%d messages (%d from the slab): %d heap allocations, %d pool fallbacks\n",
+           MESSAGES, slab, mallocs, fallbacks);
+    if (mallocCount() < 0) {
+        printf("FAIL: heap allocations cannot be counted on this host\n");
+        return 1;
+    }
+    if (mallocs != 0 || fallbacks != 0 || slab < MESSAGES) {
+        printf("FAIL\n");
+        return 1;
+    }
+    printf("PASS\n");
+    return 0;
+}
@@ -0,0 +1,361 @@
+/*
+   Host benchmark for the StateMachine core.
+
+   Drives synthetic workloads through StateMachine (message ring,
+   timer heap, deferral) using the wifi state table, and reports
+   enqueue->dispatch latency, throughput and heap allocations per
+   message.  Also times parsing a large scan: a SCAN_RESULTS reply
+   with splitString() and with the span tokenizer, and BSS RANGE
+   pages.  Nothing here talks to netd, wpa_supplicant or binder.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <utils/threads.h>
+#include <utils/Timers.h>
+#include <cutils/atomic.h>
+#include "WifiDebug.h"
+#include <utils/Log.h>
+#include "StateMachine.h"
+#include "StringUtils.h"
+#include "ScanResults.h"
+#include "wifistates.h"
+#include "MallocCounter.h"
+
+namespace android {
+
+class BenchStateMachine;
+FSM_DEFINE_TABLE(sBenchStates, BenchStateMachine, STATE_MAX, MAX_WIFI_EVENT,
+                 WIFI_FSM_STATES, WIFI_FSM_EVENTS,
+                 WIFI_FSM_TRANSITIONS, WIFI_FSM_INTERNAL)
+
+class TimedMessage : public Message {
+public:
+    TimedMessage(int command, nsecs_t sent, int arg1 = -1)
+	: Message(command, arg1), mSent(sent) {}
+    nsecs_t sent() const { return mSent; }
+private:
+    nsecs_t mSent;      // Enqueue time, or deadline for delayed messages
+};
+
+/*
+   Dispatches through the wifi transition table only, recording the
+   latency of every TimedMessage that is finally handled (deferals are
+   only counted once they are redispatched and handled).
+ */
+class BenchStateMachine : public StateMachine {
+public:
+    BenchStateMachine(size_t expected)
+	: mExpected(expected), mDone(0), mFirst(0), mLast(0)
+	, mTimerChains(0), mTimerPeriod(0) {
+	mLatency = new nsecs_t[expected];
+    }
+    virtual ~BenchStateMachine() { delete[] mLatency; }
+
+    void startTimers(int chains, int period) {
+	mTimerChains = chains;
+	mTimerPeriod = period;
+	enqueue(CMD_ENABLE_RSSI_POLL);
+    }
+    void waitDone() {
+	Mutex::Autolock _l(mLock);
+	while (mDone < mExpected)
+	    mCondition.wait(mLock);
+    }
+    void stop() {
+	requestExit();
+	enqueue(EVENT_NONE);
+	requestExitAndWait();
+    }
+    size_t   count() const { return mDone; }
+    nsecs_t *latency() const { return mLatency; }
+    nsecs_t  elapsed() const { return mLast - mFirst; }
+
+    virtual stateprocess_t invoke_process(int state, Message *message) {
+	int command = message->command();
+	int target = sBenchStates.target(state, command);
+	if (target == DEFER_STATE)
+	    return SM_DEFER;
+	if (!target)
+	    target = sBenchStates.target(DEFAULT_STATE, command);
+	if (target)
+	    transitionTo(target);
+	if (command == CMD_ENABLE_RSSI_POLL) {
+	    for (int i = 0 ; i < mTimerChains ; i++)
+		schedulePoll(i);
+	    return SM_HANDLED;
+	}
+	if (command == EVENT_NONE || mDone >= mExpected)
+	    return SM_HANDLED;
+	record(static_cast<TimedMessage *>(message));
+	if (command == CMD_RSSI_POLL)
+	    schedulePoll(message->arg1());
+	return SM_HANDLED;
+    }
+protected:
+    virtual const char *msgStr(int msg_id) { return sBenchStates.eventName(msg_id); }
+private:
+    void schedulePoll(int chain) {
+	int delay = mTimerPeriod + chain;
+	nsecs_t deadline = systemTime() + ms2ns(delay);
+	enqueueDelayed(new TimedMessage(CMD_RSSI_POLL, deadline, chain), delay);
+    }
+    void record(TimedMessage *message) {
+	nsecs_t now = systemTime();
+	if (mDone == 0)
+	    mFirst = message->sent();
+	mLast = now;
+	mLatency[mDone] = now - message->sent();
+	if (++mDone == mExpected) {
+	    Mutex::Autolock _l(mLock);
+	    mCondition.signal();
+	}
+    }
+    size_t            mExpected;
+    volatile size_t   mDone;
+    nsecs_t          *mLatency;
+    nsecs_t           mFirst, mLast;
+    int               mTimerChains, mTimerPeriod;
+    Mutex             mLock;
+    Condition         mCondition;
+};
+
+// ------------------------------------------------------------
+
+struct Workload {
+    const char *name;
+    int         initialState;
+    size_t      messages;
+    void      (*drive)(BenchStateMachine *machine, size_t messages);
+};
+
+/* Supplicant monitor: bursts of events that no state reacts to */
+static void supplicantBurst(BenchStateMachine *machine, size_t messages)
+{
+    static const int events[] = {
+	CTRL_EVENT_BSS_ADDED, CTRL_EVENT_BSS_REMOVED, SUP_SCAN_RESULTS_EVENT,
+	SUP_STATE_CHANGE_EVENT, CTRL_EVENT_LINK_SPEED,
+    };
+    static const size_t BURST = 64;
+    size_t sent = 0;
+    while (sent < messages) {
+	for (size_t i = 0 ; i < BURST && sent < messages ; i++, sent++)
+	    machine->enqueue(new TimedMessage(events[sent % (sizeof(events) / sizeof(events[0]))],
+					      systemTime()));
+	usleep(200);
+    }
+}
+
+/* RSSI polling: many timer chains, latency is measured from the deadline.
+   Coalescing only ever delays a timer, so a negative latency is a bug
+   (see the "early" column). */
+static void rssiTimers(BenchStateMachine *machine, size_t messages)
+{
+    machine->startTimers(32, 20);
+}
+
+/* Driver load/unload cycles with client commands defered in between */
+static void deferedDriverLoad(BenchStateMachine *machine, size_t messages)
+{
+    static const size_t DEFERED = 8;
+    size_t sent = 0;
+    while (sent < messages) {
+	machine->enqueue(new TimedMessage(CMD_LOAD_DRIVER, systemTime()));
+	for (size_t i = 0 ; i < DEFERED ; i++)
+	    machine->enqueue(new TimedMessage(CMD_START_DRIVER, systemTime()));
+	machine->enqueue(new TimedMessage(CMD_LOAD_DRIVER_SUCCESS, systemTime()));
+	machine->enqueue(new TimedMessage(CMD_UNLOAD_DRIVER, systemTime()));
+	for (size_t i = 0 ; i < DEFERED ; i++)
+	    machine->enqueue(new TimedMessage(CMD_STOP_DRIVER, systemTime()));
+	machine->enqueue(new TimedMessage(CMD_UNLOAD_DRIVER_SUCCESS, systemTime()));
+	sent += 2 * DEFERED + 4;
+	usleep(50);
+    }
+}
+
+static int compareNsecs(const void *a, const void *b)
+{
+    nsecs_t x = *static_cast<const nsecs_t *>(a);
+    nsecs_t y = *static_cast<const nsecs_t *>(b);
+    return x < y ? -1 : x > y;
+}
+
+static double percentileUs(const nsecs_t *sorted, size_t count, int permille)
+{
+    return sorted[count * permille / 1000] / 1000.0;
+}
+
+/* Returns the number of messages handled before they were due */
+static size_t run(const Workload& workload)
+{
+    MessagePool::Stats before, after;
+    sp<BenchStateMachine> machine = new BenchStateMachine(workload.messages);
+    machine->transitionTo(workload.initialState);
+    machine->run("wifi_bench");
+
+    MessagePool::getStats(&before);
+    int32_t mallocs = mallocCount();
+    workload.drive(machine.get(), workload.messages);
+    machine->waitDone();
+    mallocs = mallocCount() - mallocs;
+    MessagePool::getStats(&after);
+    machine->stop();
+
+    size_t count = machine->count();
+    nsecs_t *latency = machine->latency();
+    qsort(latency, count, sizeof(latency[0]), compareNsecs);
+    size_t early = 0;
+    while (early < count && latency[early] < 0)
+	early++;
+    double seconds = machine->elapsed() / 1e9;
+    printf("%-20s %8zu %10.0f %9.1f %9.1f %9.1f %8.3f %8.3f %6zu\n", workload.name, count,
+	   seconds > 0 ? count / seconds : 0.0,
+	   percentileUs(latency, count, 500), percentileUs(latency, count, 990),
+	   percentileUs(latency, count, 999),
+	   mallocs < 0 ? -1.0 : double(mallocs) / count,
+	   double(after.heapAllocs - before.heapAllocs) / count, early);
+    return early;
+}
+
+// ------------------------------------------------------------
+// SCAN_RESULTS parsing
+
+struct ParsedBss {
+    String8 bssid, ssid, flags;
+    int     frequency, rssi;
+};
+
+/* A SCAN_RESULTS reply listing 'count' BSSs */
+static String8 scanDump(size_t count)
+{
+    String8 dump("bssid / frequency / signal level / flags / ssid");
+    for (size_t i = 0 ; i < count ; i++)
+	dump.appendFormat("\n00:19:e3:%02x:%02x:2e\t%d\t%d\t[WPA2-PSK-CCMP][ESS]\tnetwork-%d",
+			  int(i >> 8) & 0xff, int(i) & 0xff, 2412 + 5 * int(i % 13),
+			  -40 - int(i % 50), int(i));
+    return dump;
+}
+
+/* As the SUP_SCAN_RESULTS_EVENT handler used to parse */
+static void parseSplit(const String8& data, Vector<ParsedBss>& result)
+{
+    result.clear();
+    Vector<String8> lines = splitString(data.string(), '\n');
+    for (size_t i = 1 ; i < lines.size() ; i++) {
+	Vector<String8> elements = splitString(lines[i], '\t');
+	if (elements.size() != 5)
+	    continue;
+	ParsedBss bss;
+	bss.bssid = elements[0];
+	bss.frequency = atoi(elements[1].string());
+	bss.rssi = atoi(elements[2].string());
+	bss.flags = elements[3];
+	bss.ssid = trimString(elements[4]);
+	result.push(bss);
+    }
+}
+
+static void addParsedBss(const BssRecord& record, void *data)
+{
+    ParsedBss bss;
+    bss.bssid = record.bssid.toString8();
+    bss.frequency = record.frequency;
+    bss.rssi = record.level;
+    bss.flags = record.flags.toString8();
+    bss.ssid = record.ssid.toString8();
+    static_cast<Vector<ParsedBss> *>(data)->push(bss);
+}
+
+static void parseSpans(const String8& data, Vector<ParsedBss>& result)
+{
+    result.clear();
+    parseScanResults(data.string(), addParsedBss, &result);
+}
+
+/* The same BSSs as BSS RANGE pages, each within the supplicant's
+   4 KB reply limit and separated by a NUL */
+static String8 bssPages(size_t count)
+{
+    String8 pages, page;
+    for (size_t i = 0 ; i < count ; i++) {
+	String8 entry;
+	entry.appendFormat("id=%d\nbssid=00:19:e3:%02x:%02x:2e\nfreq=%d\nlevel=%d\n"
+			   "tsf=0000000123456789\nflags=[WPA2-PSK-CCMP][ESS]\nssid=network-%d\n====\n",
+			   int(i), int(i >> 8) & 0xff, int(i) & 0xff, 2412 + 5 * int(i % 13),
+			   -40 - int(i % 50), int(i));
+	if (page.length() + entry.length() >= 4096) {
+	    pages.append(page);
+	    pages.append("", 1);
+	    page = "";
+	}
+	page.append(entry);
+    }
+    pages.append(page);
+    return pages;
+}
+
+static void parsePages(const String8& data, Vector<ParsedBss>& result)
+{
+    result.clear();
+    const char *page = data.string(), *end = page + data.length();
+    while (page < end) {
+	int lastId;
+	parseBssPage(page, addParsedBss, &result, &lastId);
+	page += strlen(page) + 1;
+    }
+}
+
+static void runParse(const char *name, void (*parse)(const String8&, Vector<ParsedBss>&),
+		     const String8& dump, size_t bssCount, size_t iterations)
+{
+    Vector<ParsedBss> result;
+    result.setCapacity(bssCount);
+    parse(dump, result);            // Warm up
+    int32_t mallocs = mallocCount();
+    nsecs_t start = systemTime();
+    for (size_t i = 0 ; i < iterations ; i++)
+	parse(dump, result);
+    nsecs_t elapsed = systemTime() - start;
+    mallocs = mallocCount() - mallocs;
+    printf("%-20s %8zu %10.1f %8.1f\n", name, result.size(),
+	   elapsed / 1000.0 / iterations,
+	   mallocs < 0 ? -1.0 : double(mallocs) / iterations);
+}
+
+}; // namespace android
+
+using namespace android;
+
+int main(int argc, char **argv)
+{
+    size_t scale = (argc > 1) ? atoi(argv[1]) : 1;
+    if (scale < 1)
+	scale = 1;
+    const Workload workloads[] = {
+	{ "supplicant-burst", DISCONNECTED_STATE, 100000 * scale, supplicantBurst },
+	{ "rssi-timers", DISCONNECTED_STATE, 2000 * scale, rssiTimers },
+	{ "defered-driver-load", DRIVER_UNLOADED_STATE, 100000 * scale, deferedDriverLoad },
+    };
+
+    printf("%-20s %8s %10s %9s %9s %9s %8s %8s %6s\n", "workload", "msgs", "msgs/sec",
+	   "p50(us)", "p99(us)", "p999(us)", "malloc", "fallback", "early");
+    size_t early = 0;
+    for (size_t i = 0 ; i < sizeof(workloads) / sizeof(workloads[0]) ; i++)
+	early += run(workloads[i]);
+
+    // Fields are still copied into String8s, so both parsers allocate
+    // for the three strings kept per BSS
+    printf("\n%-20s %8s %10s %8s\n", "scan-parse", "bss", "us/parse", "malloc");
+    String8 dump = scanDump(500);
+    runParse("splitString", parseSplit, dump, 500, 200 * scale);
+    runParse("tokenizer", parseSpans, dump, 500, 200 * scale);
+    runParse("bss-pages", parsePages, bssPages(500), 500, 200 * scale);
+    fflush(stdout);
+    if (early) {
+	fprintf(stderr, "%zu messages were handled before their deadline\n", early);
+	return 1;
+    }
+    return 0;
+}
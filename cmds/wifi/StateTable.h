@@ -0,0 +1,94 @@
+/*
+  Compile-time state transition tables.
+
+  A state machine is described by X-macro lists (see wifistates.h for
+  the format).  FSM_DEFINE_TABLE expands those lists into a dense
+  [states][events] array of target states, together with state and
+  event names, all as constant data: dispatch is a single array lookup
+  and nothing is initialised at runtime.
+
+  The expansion also checks the description while compiling:
+    - the same (state, event) pair listed twice fails to compile
+      (FsmTransition is specialised twice)
+    - a FSM_NORMAL state that no transition leads to fails with an
+      incomplete FsmReachableState<false>
+    - every state and event gets a row, a column and a name, because
+      all of them come from the same list as the enums
+ */
+
+#ifndef _STATE_TABLE_H
+#define _STATE_TABLE_H
+
+namespace android {
+
+// Kind of each state, used by the reachability check
+enum {
+    FSM_NORMAL,     // Must be the target of some transition
+    FSM_START,      // Initial state
+    FSM_PSEUDO,     // Not a real state (DEFER, DEFAULT)
+    FSM_SPARE       // Listed but not entered yet
+};
+
+struct StateTable {
+    int                   states;       // Rows, indexed by state id
+    int                   events;       // Columns, indexed by command id
+    const unsigned char  *actions;      // Target state, 0 if none
+    const char * const   *stateNames;
+    const char * const   *eventNames;
+
+    int target(int state, int event) const {
+        if (state < 0 || state >= states || event < 0 || event >= events)
+            return 0;
+        return actions[state * events + event];
+    }
+    const char *stateName(int state) const {
+        return (state >= 0 && state < states) ? stateNames[state] : "";
+    }
+    const char *eventName(int event) const {
+        return (event >= 0 && event < events) ? eventNames[event] : "";
+    }
+};
+
+// Tag keeps the transitions of different state machines apart
+template<class Tag, int From, int Event> struct FsmTransition { enum { target = 0 }; };
+template<bool Reachable> struct FsmReachableState;
+template<> struct FsmReachableState<true> { enum { ok = 1 }; };
+
+// ------------------------------------------------------------
+// List expanders (the first two arguments are the pass-through values)
+
+#define FSM_ENUM_EVENT(a, b, event) event,
+#define FSM_ENUM_STATE(a, b, state, name, kind) state,
+
+#define FSM_SPECIALIZE_(tag, b, from, event, to) \
+    template<> struct FsmTransition<tag, from, event> { enum { target = to }; };
+#define FSM_CELL_(tag, from, event) FsmTransition<tag, from, event>::target,
+#define FSM_ROW_(tag, EVENTS, state, name, kind) { 0, 0, EVENTS(FSM_CELL_, tag, state) },
+#define FSM_STATE_NAME_(a, b, state, name, kind) name,
+#define FSM_EVENT_NAME_(a, b, event) #event,
+#define FSM_INTO_(state, b, from, event, to) + ((to) == (state) && (from) != (state))
+#define FSM_INTERNAL_INTO_(state, b, from, to) + ((to) == (state) && (from) != (state))
+#define FSM_CHECK_STATE_(TRANSITIONS, INTERNAL, state, name, kind) \
+    enum { reachable_##state = sizeof(FsmReachableState<((kind) != FSM_NORMAL \
+        || (0 TRANSITIONS(FSM_INTO_, state, _) INTERNAL(FSM_INTERNAL_INTO_, state, _)) > 0)>) };
+
+/*
+  Define 'const StateTable name' for state machine class 'tag'.  Must be
+  used at namespace android scope, once, in a single translation unit.
+  nstates and nevents are the STATE_MAX / MAX_xxx_EVENT enum values.
+ */
+#define FSM_DEFINE_TABLE(name, tag, nstates, nevents, STATES, EVENTS, TRANSITIONS, INTERNAL) \
+    TRANSITIONS(FSM_SPECIALIZE_, tag, _) \
+    struct name##_checks { STATES(FSM_CHECK_STATE_, TRANSITIONS, INTERNAL) }; \
+    static const unsigned char name##_actions[nstates][nevents] = { \
+        { 0 }, { 0 }, STATES(FSM_ROW_, tag, EVENTS) }; \
+    static const char * const name##_stateNames[nstates] = { \
+        "", "", STATES(FSM_STATE_NAME_, _, _) }; \
+    static const char * const name##_eventNames[nevents] = { \
+        "", "", EVENTS(FSM_EVENT_NAME_, _, _) }; \
+    const StateTable name = { nstates, nevents, &name##_actions[0][0], \
+        name##_stateNames, name##_eventNames };
+
+}; // namespace android
+
+#endif // _STATE_TABLE_H
@@ -0,0 +1,102 @@
+/*
+   Configured stations indexed by network id and SSID
+ */
+
+#include "StationStore.h"
+
+namespace android {
+
+ssize_t StationStore::indexOfNetworkId(int network_id) const
+{
+    ssize_t index = mById.indexOfKey(network_id);
+    return index < 0 ? -1 : (ssize_t) mById.valueAt(index);
+}
+
+ssize_t StationStore::indexOfSsid(const String8& ssid) const
+{
+    ssize_t index = mBySsid.indexOfKey(ssid);
+    return index < 0 ? -1 : (ssize_t) mBySsid.valueAt(index);
+}
+
+void StationStore::addKeys(size_t index)
+{
+    const ConfiguredStation& station = mStations.itemAt(index);
+    if (station.network_id >= 0 && mById.indexOfKey(station.network_id) < 0)
+        mById.add(station.network_id, index);
+    if (!station.ssid.isEmpty() && mBySsid.indexOfKey(station.ssid) < 0)
+        mBySsid.add(station.ssid, index);
+}
+
+size_t StationStore::add(const ConfiguredStation& station)
+{
+    size_t index = mStations.add(station);
+    addKeys(index);
+    return index;
+}
+
+/* A new network id or SSID can move the key of a shared SSID to another
+   station, in either direction, so the indexes are rebuilt; updates
+   normally leave both alone. */
+void StationStore::replaceAt(size_t index, const ConfiguredStation& station)
+{
+    const ConfiguredStation& old = mStations.itemAt(index);
+    bool rekey = old.network_id != station.network_id || old.ssid != station.ssid;
+    mStations.replaceAt(station, index);
+    if (rekey)
+        reindex();
+}
+
+/* Removal shifts the positions of the stations that follow, so the
+   indexes are rebuilt; networks are removed far less often than they
+   are looked up. */
+void StationStore::removeAt(size_t index)
+{
+    mStations.removeAt(index);
+    reindex();
+}
+
+void StationStore::removeNetworks(const Vector<int>& network_ids)
+{
+    Vector<bool> drop;
+    drop.insertAt(false, 0, mStations.size());
+    for (size_t i = 0 ; i < network_ids.size() ; i++) {
+        ssize_t index = indexOfNetworkId(network_ids[i]);
+        if (index >= 0)
+            drop.editItemAt(index) = true;
+    }
+    Vector<ConfiguredStation> kept;
+    kept.setCapacity(mStations.size());
+    for (size_t i = 0 ; i < mStations.size() ; i++) {
+        if (!drop[i])
+            kept.push(mStations[i]);
+    }
+    mStations = kept;
+    reindex();
+}
+
+void StationStore::clear()
+{
+    mStations.clear();
+    mById.clear();
+    mBySsid.clear();
+}
+
+void StationStore::reindex()
+{
+    mById.clear();
+    mBySsid.clear();
+    for (size_t i = 0 ; i < mStations.size() ; i++)
+        addKeys(i);
+}
+
+int StationStore::maxPriority() const
+{
+    int p = 0;
+    for (size_t i = 0 ; i < mStations.size() ; i++) {
+        if (mStations[i].priority > p)
+            p = mStations[i].priority;
+    }
+    return p;
+}
+
+}; // namespace android
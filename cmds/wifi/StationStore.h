@@ -0,0 +1,53 @@
+/*
+  The configured stations (networks) known to the supplicant.
+
+  Stations keep the order of LIST_NETWORKS, which is the order they are
+  reported to clients.  They are also indexed by network id and by SSID
+  so that lookups from client requests do not walk the list.  Anything
+  that changes the network id or the SSID of a station in place must
+  call reindex(); status and priority can be edited freely.  When two
+  stations share an SSID the SSID index holds the first of them.
+
+  A StationStore is not thread safe; it belongs to the StateMachine
+  thread.  Other threads read the published copy of stations().
+ */
+
+#ifndef _STATION_STORE_H
+#define _STATION_STORE_H
+
+#include <sys/types.h>
+#include <utils/KeyedVector.h>
+#include <utils/String8.h>
+#include <wifi/IWifiClient.h>
+
+namespace android {
+
+class StationStore {
+public:
+    size_t   size() const { return mStations.size(); }
+    const ConfiguredStation& itemAt(size_t index) const { return mStations.itemAt(index); }
+    const ConfiguredStation& operator[](size_t index) const { return mStations.itemAt(index); }
+    ConfiguredStation& editItemAt(size_t index) { return mStations.editItemAt(index); }
+    ConfiguredStation *editArray() { return mStations.editArray(); }
+    // In list order, for broadcasts to clients
+    const Vector<ConfiguredStation>& stations() const { return mStations; }
+    ssize_t  indexOfNetworkId(int network_id) const;
+    ssize_t  indexOfSsid(const String8& ssid) const;
+    size_t   add(const ConfiguredStation& station);
+    void     replaceAt(size_t index, const ConfiguredStation& station);
+    void     removeAt(size_t index);
+    // Remove every station in the list, rebuilding the indexes once
+    void     removeNetworks(const Vector<int>& network_ids);
+    void     clear();
+    void     reindex();
+    int      maxPriority() const;
+private:
+    void     addKeys(size_t index);
+    Vector<ConfiguredStation>     mStations;
+    KeyedVector<int, size_t>      mById;
+    KeyedVector<String8, size_t>  mBySsid;
+};
+
+}; // namespace android
+
+#endif // _STATION_STORE_H
@@ -1,5 +1,6 @@
 
 #include "ctype.h"
+#include <string.h>
 #include "StringUtils.h"
 
 namespace android {
@@ -69,4 +70,88 @@ String8 trimString(const char *data)
     return String8(start, end-start);
 }
 
+// ------------------------------------------------------------
+
+bool StringSpan::equals(const char *s) const
+{
+    return !strncmp(data, s, length) && s[length] == 0;
+}
+
+int StringSpan::toInt() const
+{
+    const char *p = data, *end = data + length;
+    while (p < end && isspace(*p))
+	p++;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+	negative = (*p++ == '-');
+    int value = 0;
+    while (p < end && isdigit(*p))
+	value = value * 10 + (*p++ - '0');
+    return negative ? -value : value;
+}
+
+StringSpan StringSpan::trim() const
+{
+    const char *start = data, *end = data + length;
+    while (start < end && isspace(*start))
+	start++;
+    while (end > start && isspace(*(end - 1)))
+	end--;
+    return StringSpan(start, end - start);
+}
+
+StringTokenizer::StringTokenizer(const char *start, char token)
+    : mPtr(start), mEnd(start + strlen(start)), mToken(token), mDone(!*start)
+{
+}
+
+StringTokenizer::StringTokenizer(const StringSpan& span, char token)
+    : mPtr(span.data), mEnd(span.data + span.length), mToken(token), mDone(span.empty())
+{
+}
+
+bool StringTokenizer::next(StringSpan *field)
+{
+    if (mDone)
+	return false;
+    const char *p = static_cast<const char *>(memchr(mPtr, mToken, mEnd - mPtr));
+    if (!p) {
+	*field = StringSpan(mPtr, mEnd - mPtr);
+	mDone = true;
+    }
+    else {
+	*field = StringSpan(mPtr, p - mPtr);
+	mPtr = p + 1;
+    }
+    return true;
+}
+
+bool KeyValueIterator::next(StringSpan *key, StringSpan *value)
+{
+    StringSpan field;
+    while (mFields.next(&field)) {
+	const char *p = static_cast<const char *>(memchr(field.data, '=', field.length));
+	if (!p)
+	    continue;
+	*key = StringSpan(field.data, p - field.data);
+	*value = StringSpan(p + 1, field.data + field.length - (p + 1));
+	return true;
+    }
+    return false;
+}
+
+size_t splitFields(const StringSpan& line, char token, StringSpan *fields, size_t max)
+{
+    StringTokenizer tokenizer(line, token);
+    StringSpan field;
+    size_t count = 0;
+    while (tokenizer.next(&field)) {
+	if (count == max)
+	    return max + 1;
+	fields[count++] = field;
+    }
+    return count;
+}
+
 }; // namespace android
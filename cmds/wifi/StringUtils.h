@@ -15,6 +15,62 @@ int findString(const String8& data, const char *s, int start_offset = 0);
 String8 replaceString(const String8& data, const char *s1, const char *s2);
 String8 trimString(const char *data);
 
+/*
+  A piece of a string that is not copied.  Spans point into the buffer
+  they were taken from (normally a supplicant reply) and are only valid
+  while it is.  Copy out the fields you keep with toString8().
+ */
+struct StringSpan {
+    const char *data;
+    size_t      length;
+
+    StringSpan() : data(""), length(0) {}
+    StringSpan(const char *d, size_t l) : data(d), length(l) {}
+    bool    empty() const { return length == 0; }
+    bool    equals(const char *s) const;
+    int     toInt() const;              // Like atoi()
+    StringSpan trim() const;            // Without leading/trailing space
+    String8 toString8() const { return String8(data, length); }
+};
+
+/*
+  Walks the fields of a buffer separated by 'token' without copying:
+      StringTokenizer lines(reply, '\n');
+      StringSpan line;
+      while (lines.next(&line))
+          ...
+  Fields are produced exactly as splitString() would: an empty buffer
+  has no fields, and empty fields (including a trailing one) are kept.
+ */
+class StringTokenizer {
+public:
+    StringTokenizer(const char *start, char token);
+    StringTokenizer(const StringSpan& span, char token);
+    bool next(StringSpan *field);
+private:
+    const char *mPtr;
+    const char *mEnd;
+    char        mToken;
+    bool        mDone;
+};
+
+/*
+  Iterates the "key=value" fields of a buffer separated by 'token'.  The
+  key ends at the first '=' (the value may contain more); fields with
+  no '=' are skipped.
+ */
+class KeyValueIterator {
+public:
+    KeyValueIterator(const char *start, char token) : mFields(start, token) {}
+    bool next(StringSpan *key, StringSpan *value);
+private:
+    StringTokenizer mFields;
+};
+
+// Split 'line' into at most 'max' fields.  Returns the number of fields,
+// or max + 1 if there are more.
+size_t splitFields(const StringSpan& line, char token, StringSpan *fields, size_t max);
+
 };  // namespace android
 
 #endif // _STRING_UTILS_H
@@ -0,0 +1,146 @@
+/*
+   Pipelined wpa_supplicant control connection
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <src/common/wpa_ctrl.h>
+
+#include "WifiDebug.h"
+#include <utils/Log.h>
+#include "SupplicantChannel.h"
+
+namespace android {
+
+SupplicantChannel::SupplicantChannel()
+    : mCtrl(NULL), mFd(-1)
+{
+}
+
+SupplicantChannel::~SupplicantChannel()
+{
+    close();
+}
+
+bool SupplicantChannel::open(const char *path)
+{
+    close();
+    mCtrl = wpa_ctrl_open(path);
+    if (!mCtrl) {
+        SLOGW("Unable to open supplicant command connection '%s'\n", path);
+        return false;
+    }
+    mFd = wpa_ctrl_get_fd(mCtrl);
+    return true;
+}
+
+void SupplicantChannel::close()
+{
+    if (!mCtrl)
+        return;
+    wpa_ctrl_close(mCtrl);
+    mCtrl = NULL;
+    mFd = -1;
+}
+
+/* A reply that arrives after its exchange timed out would be matched
+   with the wrong request, so throw away anything already waiting. */
+void SupplicantChannel::discardStaleReplies()
+{
+    char reply[REPLY_SIZE];
+    while (recv(mFd, reply, sizeof(reply), MSG_DONTWAIT) >= 0)
+        SLOGV(".....Discarded stale supplicant reply\n");
+}
+
+String8 SupplicantChannel::command(const char *command)
+{
+    Vector<String8> commands, replies;
+    commands.push(String8(command));
+    exchange(commands, replies);
+    return replies[0];
+}
+
+bool SupplicantChannel::send(const char *command, size_t length)
+{
+    SLOGV(".....Command: %s\n", command);
+    if (::send(mFd, command, length, 0) < 0) {
+        SLOGW("Supplicant command '%s' failed: %s\n", command, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+/* Wait for the next reply; the buffer is NUL terminated and a trailing
+   newline removed.  Returns the length, or -1 on failure. */
+ssize_t SupplicantChannel::receive(char *reply, size_t size, bool *newline)
+{
+    for (;;) {
+        struct pollfd pfd;
+        pfd.fd = mFd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        int ret = poll(&pfd, 1, REPLY_TIMEOUT_MSECS);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0) {
+            SLOGW("No reply from supplicant\n");
+            return -1;
+        }
+        ssize_t len = recv(mFd, reply, size - 1, 0);
+        if (len < 0) {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+            SLOGW("Supplicant reply failed: %s\n", strerror(errno));
+            return -1;
+        }
+        if (len > 0 && reply[0] == '<')
+            continue;           // Unsolicited event, we never attach
+        bool trailing = len > 0 && reply[len-1] == '\n';
+        if (trailing)
+            len--;
+        if (newline)
+            *newline = trailing;
+        reply[len] = 0;
+        return len;
+    }
+}
+
+ssize_t SupplicantChannel::request(const char *command, char *reply, size_t size, bool *newline)
+{
+    if (!mCtrl)
+        return -1;
+    discardStaleReplies();
+    if (!send(command, strlen(command)))
+        return -1;
+    return receive(reply, size, newline);
+}
+
+size_t SupplicantChannel::exchange(const Vector<String8>& commands, Vector<String8>& replies)
+{
+    char reply[REPLY_SIZE];
+    size_t count = commands.size();
+    size_t sent = 0, received = 0;
+
+    replies.clear();
+    replies.insertAt(String8(), 0, count);
+    if (!mCtrl)
+        return 0;
+    discardStaleReplies();
+    while (received < count) {
+        for (; sent < count && sent - received < WINDOW ; sent++) {
+            if (!send(commands[sent].string(), commands[sent].length()))
+                return received;
+        }
+        ssize_t len = receive(reply, sizeof(reply));
+        if (len < 0) {
+            SLOGW("Lost reply to '%s'\n", commands[received].string());
+            return received;
+        }
+        replies.editItemAt(received++).setTo(reply, len);
+    }
+    return received;
+}
+
+}; // namespace android
@@ -0,0 +1,55 @@
+/*
+  Pipelined command connection to wpa_supplicant.
+
+  wifi_command() waits for each reply before the next request is sent.
+  The supplicant answers the requests on a control socket one at a
+  time and in order, so a batch of commands can be written back to
+  back (up to WINDOW of them outstanding, which keeps us well inside
+  the socket buffer) and the replies matched to them by position.
+
+  A SupplicantChannel is not thread safe; it belongs to the StateMachine
+  thread.
+ */
+
+#ifndef _SUPPLICANT_CHANNEL_H
+#define _SUPPLICANT_CHANNEL_H
+
+#include <utils/Vector.h>
+#include <utils/String8.h>
+
+struct wpa_ctrl;
+
+namespace android {
+
+class SupplicantChannel {
+public:
+    enum { WINDOW = 8 };                  // Requests in flight at once
+    enum { REPLY_TIMEOUT_MSECS = 10000 }; // Same as wpa_ctrl_request()
+    enum { REPLY_SIZE = 4096 };           // The supplicant's reply limit
+    SupplicantChannel();
+    ~SupplicantChannel();
+    bool     open(const char *path);
+    void     close();
+    bool     isOpen() const { return mCtrl != NULL; }
+    // One round trip.  Returns an empty string on failure.
+    String8  command(const char *command);
+    // One round trip into the caller's buffer, which is NUL terminated.
+    // Returns the reply length, or -1 on failure.  'newline' is set to
+    // whether the reply ended in a newline (since removed); one cut off
+    // at the supplicant's buffer size does not.
+    ssize_t  request(const char *command, char *reply, size_t size, bool *newline = NULL);
+    // Send every command and collect the replies in order.  Returns
+    // the number of replies received; if the connection fails part
+    // way, the replies from that one on are missing and left empty.
+    size_t   exchange(const Vector<String8>& commands, Vector<String8>& replies);
+private:
+    void     discardStaleReplies();
+    bool     send(const char *command, size_t length);
+    ssize_t  receive(char *reply, size_t size, bool *newline = NULL);
+    struct wpa_ctrl *mCtrl;
+    int              mFd;
+};
+
+}; // namespace android
+
+#endif // _SUPPLICANT_CHANNEL_H
@@ -0,0 +1,271 @@
+/*
+   wpa_supplicant monitor event dispatch
+ */
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include "WifiDebug.h"
+#include <utils/Log.h>
+#include "StringUtils.h"
+#include "SupplicantEvents.h"
+
+namespace android {
+
+// Payload parsers.  'buf' follows the prefix.
+typedef int (*event_parser_t)(SupplicantEventBatch *batch, int event, char *buf);
+
+static int parsePlain(SupplicantEventBatch *batch, int event, char *buf)
+{
+    batch->post(new Message(event));
+    return 0;
+}
+
+static int parseTerminating(SupplicantEventBatch *batch, int event, char *buf)
+{
+    batch->post(new Message(event));
+    return -1;
+}
+
+/* 'CTRL-EVENT-CONNECTED - Connection to 00:1e:58:ec:d5:6d completed (reauth) [id=1 id_str=]' */
+static int parseConnected(SupplicantEventBatch *batch, int event, char *buf)
+{
+    char *p = buf;
+    while (*p != ' ' && *p)
+        p++;
+    if (!*p) {
+        SLOGV("......unable to find termination of mac address %s\n", buf);
+        return 0;
+    }
+    *p++ = 0;
+    char *id = strstr(p, "id=");
+    if (!id) {
+        SLOGV(".....unable to find id= in %s\n", p);
+        return 0;
+    }
+    id += 3;
+    p = id;
+    while (isdigit(*p))
+        p++;
+    if (*p != ' ')
+        SLOGV(".....unable to find termination of id in %s\n", id);
+    else
+        batch->post(new Message(event, atoi(id), 0, buf));
+    return 0;
+}
+
+/* 'CTRL-EVENT-STATE-CHANGE id=0 state=9 BSSID=00:1e:58:ec:d5:6d SSID=home' */
+static int parseStateChange(SupplicantEventBatch *batch, int event, char *buf)
+{
+    KeyValueIterator items(buf, ' ');
+    StringSpan key, value, bssid;
+    int network_id = -1;
+    int new_state = -1;
+    while (items.next(&key, &value)) {
+        if (key.equals("BSSID"))
+            bssid = value;
+        else if (key.equals("id"))
+            network_id = value.toInt();
+        else if (key.equals("state"))
+            new_state = value.toInt();
+    }
+    if (new_state == -1)
+        return 0;
+    char bssidbuf[Message::MAX_STRING];
+    snprintf(bssidbuf, sizeof(bssidbuf), "%.*s", (int) bssid.length, bssid.data);
+    batch->postStateChange(new Message(event, network_id, new_state, bssidbuf));
+    return 0;
+}
+
+/* 'CTRL-EVENT-BSS-ADDED 34 00:1e:58:ec:d5:6d' */
+static int parseBss(SupplicantEventBatch *batch, int event, char *buf)
+{
+    char *p;
+    int id = strtol(buf, &p, 10);
+    if (p == buf || *p != ' ') {
+        SLOGV(".....unable to parse BSS event %s\n", buf);
+        return 0;
+    }
+    if (event == CTRL_EVENT_BSS_ADDED)
+        batch->bssAdded(id);
+    else
+        batch->bssRemoved(id, p + 1);
+    return 0;
+}
+
+/* 'CTRL-EVENT-SIGNAL-CHANGE above=1 signal=-45 noise=-95 txrate=65000'
+   arg1 is the signal level, arg2 the link speed in Mbps (-1 if absent) */
+static int parseSignalChange(SupplicantEventBatch *batch, int event, char *buf)
+{
+    KeyValueIterator items(buf, ' ');
+    StringSpan key, value;
+    int rssi = -9999;
+    int link_speed = -1;
+    while (items.next(&key, &value)) {
+        if (key.equals("signal"))
+            rssi = value.toInt();
+        else if (key.equals("txrate"))
+            link_speed = value.toInt() / 1000;
+    }
+    if (rssi != -9999)
+        batch->post(new Message(event, rssi, link_speed));
+    return 0;
+}
+
+// ------------------------------------------------------------
+
+/* X(index, prefix, event, parser); a NULL parser drops the event.
+   Entries that share a trie branch must stay next to each other. */
+#define SUPPLICANT_EVENTS(X) \
+    X(EV_BSS_ADDED,      "CTRL-EVENT-BSS-ADDED ",       CTRL_EVENT_BSS_ADDED,         parseBss) \
+    X(EV_BSS_REMOVED,    "CTRL-EVENT-BSS-REMOVED ",     CTRL_EVENT_BSS_REMOVED,       parseBss) \
+    X(EV_STATE_CHANGE,   "CTRL-EVENT-STATE-CHANGE ",    SUP_STATE_CHANGE_EVENT,       parseStateChange) \
+    X(EV_SCAN_RESULTS,   "CTRL-EVENT-SCAN-RESULTS",     SUP_SCAN_RESULTS_EVENT,       parsePlain) \
+    X(EV_SCAN_STARTED,   "CTRL-EVENT-SCAN-STARTED",     CTRL_EVENT_SCAN_STARTED,      parsePlain) \
+    X(EV_SIGNAL_CHANGE,  "CTRL-EVENT-SIGNAL-CHANGE ",   CTRL_EVENT_SIGNAL_CHANGE,     parseSignalChange) \
+    X(EV_CONNECTED,      "CTRL-EVENT-CONNECTED - Connection to ", NETWORK_CONNECTION_EVENT, parseConnected) \
+    X(EV_RECONNECTED,    "CTRL-EVENT-CONNECTED - connection to ", NETWORK_RECONNECTION_EVENT, NULL) \
+    X(EV_DISCONNECTED,   "CTRL-EVENT-DISCONNECTED ",    NETWORK_DISCONNECTION_EVENT,  parsePlain) \
+    X(EV_DRIVER_STATE,   "CTRL-EVENT-DRIVER-STATE ",    CTRL_EVENT_DRIVER_STATE,      NULL) \
+    X(EV_LINK_SPEED,     "CTRL-EVENT-LINK-SPEED ",      CTRL_EVENT_LINK_SPEED,        NULL) \
+    X(EV_TERMINATING,    "CTRL-EVENT-TERMINATING",      SUP_DISCONNECTION_EVENT,      parseTerminating) \
+    X(EV_EAP_FAILURE,    "CTRL-EVENT-EAP-FAILURE ",     CTRL_EVENT_EAP_FAILURE,       NULL) \
+    X(EV_KEY_COMPLETED,  "WPA: Key negotiation completed with ", KEY_COMPLETED_EVENT, NULL) \
+    X(EV_AUTH_FAILURE,   "WPA:",                        AUTHENTICATION_FAILURE_EVENT, parsePlain) \
+    X(EV_WPS_AP,         "WPS-AP-AVAILABLE",            WPS_AP_AVAILABLE_EVENT,       NULL) \
+    X(EV_ASSOCIATED,     "Associated with ",            ASSOCIATED_WITH_EVENT,        NULL) \
+
+struct SupplicantEvent {
+    const char     *prefix;
+    size_t          length;
+    int             event;
+    event_parser_t  parse;
+};
+
+#define EVENT_INDEX_(index, prefix, event, parser) index,
+#define EVENT_ENTRY_(index, prefix, event, parser) { prefix, sizeof(prefix) - 1, event, parser },
+enum { SUPPLICANT_EVENTS(EVENT_INDEX_) EV_COUNT };
+static const SupplicantEvent sEvents[EV_COUNT] = { SUPPLICANT_EVENTS(EVENT_ENTRY_) };
+
+// The first of 'count' entries starting at 'first' that prefixes buf
+static const SupplicantEvent *match(const char *buf, int first, int count = 1)
+{
+    for (const SupplicantEvent *e = &sEvents[first] ; count-- > 0 ; e++) {
+        if (!strncmp(buf, e->prefix, e->length))
+            return e;
+    }
+    return NULL;
+}
+
+static const SupplicantEvent *classify(const char *buf)
+{
+    static const size_t CTRL = sizeof("CTRL-EVENT-") - 1;
+    switch (buf[0]) {
+    case 'C':
+        if (strncmp(buf, "CTRL-EVENT-", CTRL))
+            return NULL;
+        switch (buf[CTRL]) {
+        case 'B': return match(buf, EV_BSS_ADDED, 2);
+        case 'S':
+            switch (buf[CTRL + 1]) {
+            case 'T': return match(buf, EV_STATE_CHANGE);
+            case 'C': return match(buf, EV_SCAN_RESULTS, 2);
+            case 'I': return match(buf, EV_SIGNAL_CHANGE);
+            }
+            return NULL;
+        case 'C': return match(buf, EV_CONNECTED, 2);
+        case 'D': return match(buf, EV_DISCONNECTED, 2);
+        case 'L': return match(buf, EV_LINK_SPEED);
+        case 'T': return match(buf, EV_TERMINATING);
+        case 'E': return match(buf, EV_EAP_FAILURE);
+        }
+        return NULL;
+    case 'W':
+        // The key negotiation prefix is longer, so it is tried first
+        if (buf[1] == 'P' && buf[2] == 'A')
+            return match(buf, EV_KEY_COMPLETED, 2);
+        return match(buf, EV_WPS_AP);
+    case 'A':
+        return match(buf, EV_ASSOCIATED);
+    }
+    return NULL;
+}
+
+// ------------------------------------------------------------
+
+SupplicantEventBatch::SupplicantEventBatch(StateMachine *machine)
+    : mMachine(machine), mBssChanges(NULL), mStateChange(NULL), mEvents(0)
+{
+}
+
+SupplicantEventBatch::~SupplicantEventBatch()
+{
+    flush();
+}
+
+int SupplicantEventBatch::add(char *buf)
+{
+    const SupplicantEvent *e = classify(buf);
+    if (!e) {
+        SLOGV(".....Unknown supplicant event: %s\n", buf);
+        return 0;
+    }
+    mEvents++;
+    if (e->event != CTRL_EVENT_BSS_ADDED && e->event != CTRL_EVENT_BSS_REMOVED)
+        SLOGV(".....EVENT: '%s'\n", buf);
+    return e->parse ? e->parse(this, e->event, buf + e->length) : 0;
+}
+
+void SupplicantEventBatch::flush()
+{
+    if (mBssChanges) {
+        if (mBssChanges->added.size() || mBssChanges->removed.size())
+            mMachine->enqueue(mBssChanges);
+        else
+            delete mBssChanges;
+        mBssChanges = NULL;
+    }
+    if (mStateChange) {
+        mMachine->enqueue(mStateChange);
+        mStateChange = NULL;
+    }
+}
+
+// Scan results and connection events must see the BSS and state
+// changes that came before them
+void SupplicantEventBatch::post(Message *message)
+{
+    flush();
+    mMachine->enqueue(message);
+}
+
+void SupplicantEventBatch::postStateChange(Message *message)
+{
+    if (mStateChange)
+        SLOGV(".....Superseded state change %d\n", mStateChange->arg2());
+    delete mStateChange;
+    mStateChange = message;
+}
+
+void SupplicantEventBatch::bssAdded(int id)
+{
+    if (!mBssChanges)
+        mBssChanges = new BssChangesMessage();
+    mBssChanges->added.push(id);
+}
+
+void SupplicantEventBatch::bssRemoved(int id, const char *bssid)
+{
+    if (!mBssChanges)
+        mBssChanges = new BssChangesMessage();
+    // An entry that came and went within the batch need not be read
+    for (size_t i = 0 ; i < mBssChanges->added.size() ; i++) {
+        if (mBssChanges->added[i] == id) {
+            mBssChanges->added.removeAt(i);
+            break;
+        }
+    }
+    mBssChanges->removed.push(String8(bssid));
+}
+
+}; // namespace android
@@ -0,0 +1,59 @@
+/*
+  Classification of wpa_supplicant monitor events.
+
+  Each event prefix is listed once, together with the state machine
+  event it maps to and the parser for its payload.  Events are found
+  with a small switch trie on the characters that tell the prefixes
+  apart, so the frequent BSS and state change events cost a couple of
+  character tests and one string compare, not a scan of the list.
+
+  Events read in one monitor wakeup are collected in a batch.  BSS
+  additions and removals become a single CTRL_EVENT_BSS_CHANGES message,
+  and a run of state changes only posts the latest one.  Every other
+  event is posted in order, after whatever was collected before it.
+ */
+
+#ifndef _SUPPLICANT_EVENTS_H
+#define _SUPPLICANT_EVENTS_H
+
+#include <utils/Vector.h>
+#include <utils/String8.h>
+#include "StateMachine.h"
+#include "wifistates.h"
+
+namespace android {
+
+// The BSS-ADDED and BSS-REMOVED events of one batch
+class BssChangesMessage : public Message {
+public:
+    BssChangesMessage() : Message(CTRL_EVENT_BSS_CHANGES) {}
+    Vector<int>     added;      // Supplicant BSS ids
+    Vector<String8> removed;    // BSSIDs
+};
+
+class SupplicantEventBatch {
+public:
+    SupplicantEventBatch(StateMachine *machine);
+    ~SupplicantEventBatch();
+    /* Classify one monitor event ('buf' has had its "IFNAME=" and "<N>"
+       prefixes removed).  Returns -1 if the supplicant is going away,
+       0 otherwise. */
+    int  add(char *buf);
+    // Post everything collected so far
+    void flush();
+    // Used by the payload parsers
+    void post(Message *message);
+    void postStateChange(Message *message);
+    void bssAdded(int id);
+    void bssRemoved(int id, const char *bssid);
+    size_t eventCount() const { return mEvents; }
+private:
+    StateMachine      *mMachine;
+    BssChangesMessage *mBssChanges;
+    Message           *mStateChange;
+    size_t             mEvents;
+};
+
+}; // namespace android
+
+#endif // _SUPPLICANT_EVENTS_H
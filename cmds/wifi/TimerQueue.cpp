@@ -0,0 +1,148 @@
+/*
+   Timer heap for delayed StateMachine messages
+ */
+
+#include "StateMachine.h"
+#include "TimerQueue.h"
+
+namespace android {
+
+TimerQueue::TimerQueue(nsecs_t slack)
+    : mSlack(slack), mNextHandle(1), mCount(0)
+{
+}
+
+TimerQueue::~TimerQueue()
+{
+    for (size_t i = 0 ; i < mCount ; i++)
+        delete mHeap[i].message;
+}
+
+bool TimerQueue::before(const Timer& a, const Timer& b) const
+{
+    if (a.when != b.when)
+        return a.when < b.when;
+    // Handles increase monotonically (modulo wrap), so this keeps FIFO order
+    return (a.handle - b.handle) < 0;
+}
+
+void TimerQueue::siftUp(size_t index)
+{
+    Timer t = mHeap[index];
+    while (index > 0) {
+        size_t parent = (index - 1) / 2;
+        if (!before(t, mHeap[parent]))
+            break;
+        mHeap.editItemAt(index) = mHeap[parent];
+        index = parent;
+    }
+    mHeap.editItemAt(index) = t;
+}
+
+void TimerQueue::siftDown(size_t index)
+{
+    Timer t = mHeap[index];
+    size_t n = mCount;
+    while (1) {
+        size_t child = 2 * index + 1;
+        if (child >= n)
+            break;
+        if (child + 1 < n && before(mHeap[child + 1], mHeap[child]))
+            child++;
+        if (!before(mHeap[child], t))
+            break;
+        mHeap.editItemAt(index) = mHeap[child];
+        index = child;
+    }
+    mHeap.editItemAt(index) = t;
+}
+
+void TimerQueue::removeAt(size_t index)
+{
+    size_t last = --mCount;
+    if (index != last) {
+        mHeap.editItemAt(index) = mHeap[last];
+        if (index > 0 && before(mHeap[index], mHeap[(index - 1) / 2]))
+            siftUp(index);
+        else
+            siftDown(index);
+    }
+}
+
+int TimerQueue::add(Message *message, nsecs_t when)
+{
+    Timer t;
+    t.when = when;
+    t.handle = mNextHandle;
+    t.message = message;
+    if (++mNextHandle <= 0)
+        mNextHandle = 1;
+    if (mCount < mHeap.size())
+        mHeap.editItemAt(mCount) = t;
+    else
+        mHeap.push(t);
+    siftUp(mCount++);
+    return t.handle;
+}
+
+bool TimerQueue::cancel(int handle)
+{
+    for (size_t i = 0 ; i < mCount ; i++)
+        if (mHeap[i].handle == handle) {
+            delete mHeap[i].message;
+            removeAt(i);
+            return true;
+        }
+    return false;
+}
+
+int TimerQueue::cancelCommand(int command)
+{
+    int count = 0;
+    size_t i = 0;
+    while (i < mCount) {
+        if (mHeap[i].message->command() == command) {
+            delete mHeap[i].message;
+            removeAt(i);
+            count++;
+            i = 0;      // The heap was reshuffled; rescan from the top
+        } else
+            i++;
+    }
+    return count;
+}
+
+bool TimerQueue::hasCommand(int command) const
+{
+    for (size_t i = 0 ; i < mCount ; i++)
+        if (mHeap[i].message->command() == command)
+            return true;
+    return false;
+}
+
+Message *TimerQueue::expired(nsecs_t now)
+{
+    if (mCount == 0 || mHeap[0].when > now)
+        return NULL;
+    Message *message = mHeap[0].message;
+    removeAt(0);
+    return message;
+}
+
+/* The first timer waits up to the slack for the others due after it.
+   The heap is small, so it is simply scanned. */
+nsecs_t TimerQueue::nextDeadline() const
+{
+    if (mCount == 0)
+        return -1;
+    nsecs_t limit = mHeap[0].when + mSlack;
+    nsecs_t deadline = mHeap[0].when;
+    for (size_t i = 1 ; i < mCount ; i++) {
+        nsecs_t when = mHeap[i].when;
+        if (when <= limit && when > deadline)
+            deadline = when;
+    }
+    return deadline;
+}
+
+}; // namespace android
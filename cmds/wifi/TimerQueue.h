@@ -0,0 +1,53 @@
+/*
+  Delayed messages for the StateMachine.
+
+  Timers are kept in a binary min-heap ordered by deadline (ties are
+  broken by creation order, so timers for the same instant fire FIFO).
+  Every timer gets a handle that can be used to cancel it; timers can
+  also be cancelled by command id.  Timers are coalesced by delaying
+  them, never by firing them early: the queue wakes at the deadline of
+  the last timer due within the slack of the first, and delivers them
+  all then.
+
+  A TimerQueue is not thread safe; it belongs to the StateMachine thread.
+ */
+
+#ifndef _TIMER_QUEUE_H
+#define _TIMER_QUEUE_H
+
+#include <utils/Vector.h>
+#include <utils/Timers.h>
+
+namespace android {
+
+class Message;
+class TimerQueue {
+public:
+    TimerQueue(nsecs_t slack);
+    ~TimerQueue();
+    int      add(Message *message, nsecs_t when);  // Returns a handle > 0
+    bool     cancel(int handle);
+    int      cancelCommand(int command);           // Returns number cancelled
+    bool     hasCommand(int command) const;
+    Message *expired(nsecs_t now);   // NULL if nothing is due
+    nsecs_t  nextDeadline() const;   // When to wake, -1 if there are no timers
+    size_t   size() const { return mCount; }
+private:
+    struct Timer {
+        nsecs_t  when;
+        int      handle;
+        Message *message;
+    };
+    bool     before(const Timer& a, const Timer& b) const;
+    void     removeAt(size_t index);
+    void     siftUp(size_t index);
+    void     siftDown(size_t index);
+    nsecs_t        mSlack;
+    int            mNextHandle;
+    Vector<Timer>  mHeap;     // Only grows, so steady state doesn't allocate
+    size_t         mCount;
+};
+
+}; // namespace android
+
+#endif // _TIMER_QUEUE_H
@@ -9,7 +9,12 @@
 #undef LOG_TAG
 
 // LOG_NDEBUG 0 enables VERBOSE logging
+#ifdef WIFI_BENCHMARK
+// Benchmarks measure the state machine, not the logger
+#define LOG_NDEBUG 1
+#else
 #define LOG_NDEBUG 0
+#endif
 
 #define LOG_TAG "KlaatuWifi"
 
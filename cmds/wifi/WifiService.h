@@ -21,12 +21,18 @@ public:
 
     // IBinder::DeathRecipient
     virtual void binderDied(const wp<IBinder>& who);
+    // "dumpsys wifi"
+    virtual status_t dump(int fd, const Vector<String16>& args);
 
     // BnWifiService
     virtual void Register(const sp<IWifiClient>& client, WifiClientFlag flags);
     virtual void SetEnabled(bool enabled);
     virtual void SendCommand(int command, int arg1, int arg2);
     virtual void AddOrUpdateNetwork(const ConfiguredStation& cs);
+    virtual void ResyncScanResults(const sp<IWifiClient>& client);
+    virtual void SetRssiHysteresis(const sp<IWifiClient>& client, int dbm);
+    virtual void AddOrUpdateNetworks(const Vector<ConfiguredStation>& stations);
+    virtual void RemoveNetworks(const Vector<int>& network_ids);
 
     // Functions invoked by the WifiStateMachine
     void BroadcastState(WifiState state);
@@ -38,10 +44,14 @@ public:
     static char const* getServiceName() { return "wifi"; }
 
 private:
+    void              sendScanSnapshot(WifiServerClient *client);
+
     mutable Mutex     mLock;
     WifiStateMachine *mWifiStateMachine;
     KeyedVector< wp<IBinder>, WifiServerClient *> mClients;
     WifiState         mState;
+    KeyedVector<String8, ScannedStation> mScanResults;  // Last broadcast, by bssid
+    int               mScanGeneration;
  };
 }; // namespace android
 
@@ -8,7 +8,11 @@
 
 #include <stdio.h>
 #include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
 #include <cutils/properties.h>
 #include <cutils/sockets.h>
 #include <hardware_legacy/wifi.h>
@@ -36,37 +40,57 @@ int dhcp_stop(const char *ifname);
 #include <utils/String8.h>
 #define BIT(x) (1 << (x))      /* needed for wpa supplicant defs.h */
 #include <src/common/defs.h>   /* WPA_xxx names from external/wpa_supplicant_x */
+#include <src/common/wpa_ctrl.h>
 
 #include "WifiDebug.h"
 #include "StringUtils.h"
+#include "ScanResults.h"
+#include "SupplicantEvents.h"
 #include "WifiService.h"
 
-typedef struct {
-   int event;
-   int state;
-} STATE_TRANSITION;
-typedef struct {
-    const char *name;
-    STATE_TRANSITION *tran;
-} STATE_TABLE_TYPE;
-
-#define FSM_INITIALIZE_CODE
 #include "WifiStateMachine.h"
 
 namespace android {
 
+FSM_DEFINE_TABLE(sWifiStates, WifiStateMachine, STATE_MAX, MAX_WIFI_EVENT,
+                 WIFI_FSM_STATES, WIFI_FSM_EVENTS,
+                 WIFI_FSM_TRANSITIONS, WIFI_FSM_INTERNAL)
+
 static const int BUF_SIZE=256;
-static const int RSSI_POLL_INTERVAL_MSECS = 3000;
+// Information is rebroadcast when the signal moves this far
+static const int INFORMATION_RSSI_STEP_DB = 3;
 static const int SUPPLICANT_RESTART_INTERVAL_MSECS = 5000;
+// A scan that has not reported results by now is assumed lost
+static const int SCAN_PENDING_TIMEOUT_MSECS = 10000;
+// The BSS table is read in full at most this often
+static const int BSS_RECONCILE_INTERVAL_MSECS = 30000;
+// Monitor events handled per wakeup before yielding to the message queue
+static const int MONITOR_BATCH_EVENTS = 64;
+// Initial size of the monitor read buffer; it grows to fit longer events
+static const int MONITOR_BUFFER_SIZE = 1024;
+// Handlers running longer than this are reported by the watchdog
+static const int HANDLER_BUDGET_MSECS = 500;
+static const char *SUPPLICANT_IFACE_DIR = "/data/system/wpa_supplicant";
+static const char *DHCP_LEASE_CACHE_PATH = "/data/misc/wifi/klaatu_dhcp_leases";
+// A cached lease is only used if it stays valid at least this long
+static const int DHCP_LEASE_MARGIN_SECS = 60;
+// Configuration changes are saved once they stop arriving for this long,
+// but a save is never put off for longer than the maximum
+static const int SAVE_CONFIG_DELAY_MSECS = 2000;
+static const int SAVE_CONFIG_MAX_DELAY_MSECS = 10000;
 
 /* message class to carry DHCP results */
 class DhcpResultMessage : public Message {
 public:
-    DhcpResultMessage(const char *in_ipaddr, const char *in_gateway,
-               const char *in_dns1, const char *in_dns2, const char *in_server)
-    : Message(DHCP_SUCCESS) , ipaddr(in_ipaddr) , gateway(in_gateway)
-    , dns1(in_dns1) , dns2(in_dns2) , server(in_server) {}
+    DhcpResultMessage(int generation, const char *in_ipaddr, const char *in_gateway,
+               const char *in_dns1, const char *in_dns2, const char *in_server,
+               int in_prefixLength, int in_lease)
+    : Message(DHCP_SUCCESS, generation) , ipaddr(in_ipaddr) , gateway(in_gateway)
+    , dns1(in_dns1) , dns2(in_dns2) , server(in_server)
+    , prefixLength(in_prefixLength) , lease(in_lease) {}
     String8 ipaddr, gateway, dns1, dns2, server;
+    int     prefixLength;
+    int     lease;          // Seconds
 };
 
 /* message class to carry extra configuration data for network add/update */
@@ -77,6 +101,15 @@ public:
     ConfiguredStation mConfig;
 };
 
+/* message class to carry a batch of network changes */
+class NetworkBatchMessage : public Message {
+public:
+    NetworkBatchMessage(const Vector<ConfiguredStation>& updates, const Vector<int>& removals)
+    : Message(CMD_UPDATE_NETWORKS) , mUpdates(updates) , mRemovals(removals) {}
+    Vector<ConfiguredStation> mUpdates;
+    Vector<int>               mRemovals;
+};
+
 static int extractSequence(const char *buf)
 {
     int result = 0;
@@ -95,160 +128,109 @@ static int extractCode(const char *buf)
     return -1;
 }
 
-static int seqno;
+/* Only called on the state machine thread, which also owns the netd
+   connection.  Replies to other commands and unsolicited broadcasts
+   that arrive while we wait are dispatched as they come in. */
 String8 WifiStateMachine::ncommand(const char *fmt, ...)
 {
-    String8 response;
-    int code = -1;
-    char buf[BUF_SIZE];
-    char *p = buf;
     va_list args;
-
-    Mutex::Autolock _l(mLock);
-    mResponseQueue.clear();
-    seqno = ++mSequenceNumber;
     va_start(args, fmt);
-    snprintf(p, sizeof(buf), "%d ", seqno);
-    p += strlen(p);
-    vsnprintf(p, sizeof(buf) - (p - buf), fmt, args);
+    String8 response = mNetd.vcommand(fmt, args);
     va_end(args);
-
-    SLOGV(".....Netd:          '%s'\n", buf);
-    int len = ::write(mFd, buf, strlen(buf) + 1);
-    if (len < 0) {
-        perror("Unable to write to daemon socket");
-        exit(1);
-    }
-    while (code < 200 || code >= 600) {
-        while (mResponseQueue.size() == 0)
-            mCondition.wait(mLock);
-        response = mResponseQueue[0];
-        mResponseQueue.removeAt(0);
-        code = extractCode(response.string());
-        SLOGV(".....Netd: resp '%s'", response.string());
-    }
     return response;
 }
 
-bool WifiStateMachine::process_indication()
+// Completion for netd commands nobody waits for
+static void netdReply(int code, const StringSpan& reply, void *data)
 {
-    int count = ::read(mFd, indication_buf + indication_start, sizeof(indication_buf) - indication_start);
-    if (count < 0) {
-        perror("Error reading daemon socket");
-        return true;
-    }
-    count += indication_start;
-    indication_start = 0;
-    for (int i = 0 ; i < count ; i++) {
-        if (!indication_buf[i]) {
-            Mutex::Autolock _l(mLock);
-            mResponseQueue.push(String8(indication_buf + indication_start, i - indication_start));
-            mCondition.signal();
-            indication_start = i + 1;
-        }
-    }
-    if (indication_start < count) 
-        memcpy(indication_buf, indication_buf+indication_start, count - indication_start);
-    indication_start = count - indication_start;
-    return false;
+    if (code < 0 || code >= 400)
+        SLOGW("Netd command failed: %d '%s'\n", code, reply.data);
 }
 
-int WifiStateMachine::request_wifi(int request)
+static void netdEvent(int code, const StringSpan& event, void *data)
 {
-    static const char *reqname[] = {"",
-        "WIFI_LOAD_DRIVER", "WIFI_UNLOAD_DRIVER", "WIFI_IS_DRIVER_LOADED",
-        "WIFI_START_SUPPLICANT", "WIFI_STOP_SUPPLICANT",
-        "WIFI_CONNECT_SUPPLICANT", "WIFI_CLOSE_SUPPLICANT", "WIFI_WAIT_EVENT",
-        "DHCP_STOP", "DHCP_DO_REQUEST"};
-    static struct {
-        const char *name;
-        int event;
-    } event_map[] = {
-        // We make a LOT of assumptions about the CONNECTED format
-        {"CTRL-EVENT-CONNECTED - Connection to ", NETWORK_CONNECTION_EVENT},
-        {"CTRL-EVENT-CONNECTED - connection to ", NETWORK_RECONNECTION_EVENT},
-        {"CTRL-EVENT-DISCONNECTED ", NETWORK_DISCONNECTION_EVENT},
-        {"CTRL-EVENT-STATE-CHANGE ", SUP_STATE_CHANGE_EVENT},
-        {"CTRL-EVENT-SCAN-RESULTS ", SUP_SCAN_RESULTS_EVENT},
-        {"CTRL-EVENT-LINK-SPEED ", CTRL_EVENT_LINK_SPEED},
-        {"CTRL-EVENT-TERMINATING ", SUP_DISCONNECTION_EVENT},
-        {"CTRL-EVENT-DRIVER-STATE ", CTRL_EVENT_DRIVER_STATE},
-        {"CTRL-EVENT-EAP-FAILURE ", CTRL_EVENT_EAP_FAILURE},
-        {"CTRL-EVENT-BSS-ADDED ", CTRL_EVENT_BSS_ADDED},
-        {"CTRL-EVENT-BSS-REMOVED ", CTRL_EVENT_BSS_REMOVED},
-        {"WPA: Key negotiation completed with ", KEY_COMPLETED_EVENT},
-        {"Associated with ", ASSOCIATED_WITH_EVENT},
-        {"WPS-AP-AVAILABLE", WPS_AP_AVAILABLE_EVENT},
-        {"WPA:", AUTHENTICATION_FAILURE_EVENT}, {NULL, 0} };
-    int ret = 0;
-    char rbuf[BUF_SIZE];  // Will store a UTF string
+    SLOGV(".....Netd broadcast %d '%s'\n", code, event.data);
+}
 
-    if (request != WIFI_WAIT_EVENT)
-        SLOGD("....REQ: %s\n", reqname[request]);
-    switch (request) {
-    case DHCP_STOP:
-        return ::dhcp_stop(mInterface.string());
-    case DHCP_DO_REQUEST: {
-        uint32_t prefixLength, lease;
-        char ipaddr[PROPERTY_VALUE_MAX], gateway[PROPERTY_VALUE_MAX];
-        char dns1[PROPERTY_VALUE_MAX], dns2[PROPERTY_VALUE_MAX];
-        char server[PROPERTY_VALUE_MAX], vendorInfo[PROPERTY_VALUE_MAX];
+/* Runs dhcpcd for the interface; this blocks until a lease is obtained
+   or dhcpcd gives up.  'generation' is returned in the result message so
+   results that arrive after a disconnect can be ignored. */
+Message *WifiStateMachine::dhcp_request(int generation)
+{
+    uint32_t prefixLength, lease;
+    char ipaddr[PROPERTY_VALUE_MAX], gateway[PROPERTY_VALUE_MAX];
+    char dns1[PROPERTY_VALUE_MAX], dns2[PROPERTY_VALUE_MAX];
+    char server[PROPERTY_VALUE_MAX], vendorInfo[PROPERTY_VALUE_MAX];
 
 #if (SHORT_PLATFORM_VERSION == 23)
-        struct in_addr tt;
-        in_addr_t t_ipaddr, t_gateway, t_dns1, t_dns2, t_server;
-        int result = ::dhcp_do_request( mInterface.string(),
-            &t_ipaddr, &t_gateway, &prefixLength, &t_dns1, &t_dns2, &t_server, &lease);
+    struct in_addr tt;
+    in_addr_t t_ipaddr, t_gateway, t_dns1, t_dns2, t_server;
+    int result = ::dhcp_do_request( mInterface.string(),
+        &t_ipaddr, &t_gateway, &prefixLength, &t_dns1, &t_dns2, &t_server, &lease);
+    // 2.3 returns the netmask rather than the prefix length
+    uint32_t mask = ntohl(prefixLength);
+    for (prefixLength = 0 ; mask & 0x80000000 ; mask <<= 1)
+        prefixLength++;
 #define CPY(A) tt.s_addr = t_ ## A; strcpy(A, inet_ntoa(tt));
-        CPY(ipaddr)
-        CPY(gateway)
-        CPY(dns1)
-        CPY(dns2)
-        CPY(server)
+    CPY(ipaddr)
+    CPY(gateway)
+    CPY(dns1)
+    CPY(dns2)
+    CPY(server)
 #undef CPY
 #elif (SHORT_PLATFORM_VERSION == 40)
-        int result = ::dhcp_do_request( mInterface.string(),
-            ipaddr, gateway, &prefixLength, dns1, dns2, server, &lease);
+    int result = ::dhcp_do_request( mInterface.string(),
+        ipaddr, gateway, &prefixLength, dns1, dns2, server, &lease);
 #elif (SHORT_PLATFORM_VERSION == 41) || (SHORT_PLATFORM_VERSION == 42)
-        int result = ::dhcp_do_request( mInterface.string(),
-            ipaddr, gateway, &prefixLength, dns1, dns2, server, &lease,
-            vendorInfo);
+    int result = ::dhcp_do_request( mInterface.string(),
+        ipaddr, gateway, &prefixLength, dns1, dns2, server, &lease,
+        vendorInfo);
 #elif (SHORT_PLATFORM_VERSION == 43)
-        char *dns[3] = {dns1, dns2, NULL};
-        char domains[PROPERTY_VALUE_MAX];
-        int result = ::dhcp_do_request( mInterface.string(),
-            ipaddr, gateway, &prefixLength, dns, server, &lease,
-            vendorInfo, domains);
+    char *dns[3] = {dns1, dns2, NULL};
+    char domains[PROPERTY_VALUE_MAX];
+    int result = ::dhcp_do_request( mInterface.string(),
+        ipaddr, gateway, &prefixLength, dns, server, &lease,
+        vendorInfo, domains);
 #elif (SHORT_PLATFORM_VERSION == 44)
-        char *dns[3] = {dns1, dns2, NULL};
-        char domain[PROPERTY_VALUE_MAX];
-        char mtu[PROPERTY_VALUE_MAX]; 
-        int result = ::dhcp_do_request( mInterface.string(),
-            ipaddr, gateway, &prefixLength, dns, server, &lease,
-            vendorInfo, domain, mtu);
+    char *dns[3] = {dns1, dns2, NULL};
+    char domain[PROPERTY_VALUE_MAX];
+    char mtu[PROPERTY_VALUE_MAX]; 
+    int result = ::dhcp_do_request( mInterface.string(),
+        ipaddr, gateway, &prefixLength, dns, server, &lease,
+        vendorInfo, domain, mtu);
 #else
 #error Unknown Platform version
 #endif
-        SLOGD("......dhcp_do_request: result %d\n", result);
-        if (result)
-            enqueue(DHCP_FAILURE);
-        else
-            enqueue(new DhcpResultMessage(ipaddr, gateway, dns1, dns2, server));
-        break;
-        }
+    SLOGD("......dhcp_do_request: result %d\n", result);
+    if (result)
+        return new Message(DHCP_FAILURE, generation);
+    return new DhcpResultMessage(generation, ipaddr, gateway, dns1, dns2, server,
+                                 prefixLength, lease);
+}
+
+int WifiStateMachine::request_wifi(int request)
+{
+    static const char *reqname[] = {"",
+        "WIFI_LOAD_DRIVER", "WIFI_UNLOAD_DRIVER", "WIFI_IS_DRIVER_LOADED",
+        "WIFI_START_SUPPLICANT", "WIFI_STOP_SUPPLICANT",
+        "WIFI_CONNECT_SUPPLICANT", "WIFI_CLOSE_SUPPLICANT", "WIFI_WAIT_EVENT",
+        "DHCP_STOP"};
+    int ret = 0;
+
+    if (request != WIFI_WAIT_EVENT)
+        SLOGD("....REQ: %s\n", reqname[request]);
+    switch (request) {
+    case DHCP_STOP:
+        return ::dhcp_stop(mInterface.string());
     case WIFI_LOAD_DRIVER:
         /* The Driver states refer to the kernel model.  Executing
           "wifi_load_driver()" causes the appropriate kernel model for your
           board to be inserted and executes a firmware loader.  
           This is tied in tightly to the property system, looking at the
           "wlan.driver.status" property to see if the driver has been loaded. */
-        ret = wifi_load_driver();
-        enqueue(!ret ? CMD_LOAD_DRIVER_SUCCESS : CMD_LOAD_DRIVER_FAILURE);
-        break;
+        return wifi_load_driver();
     case WIFI_UNLOAD_DRIVER:
-        ret = wifi_unload_driver();
-        enqueue(!ret ? CMD_UNLOAD_DRIVER_SUCCESS : CMD_UNLOAD_DRIVER_FAILURE);
-        break;
+        return wifi_unload_driver();
     case WIFI_IS_DRIVER_LOADED:
 #if (SHORT_PLATFORM_VERSION == 23)
         return false;
@@ -258,109 +240,70 @@ int WifiStateMachine::request_wifi(int request)
     case WIFI_START_SUPPLICANT:
         return wifi_start_supplicant(WIFI_DEVICE_ID);
     case WIFI_STOP_SUPPLICANT:
+        closeMonitor();
 #if defined(LONG_PLATFORM_VERSION) && (LONG_PLATFORM_VERSION > 421)
         return wifi_stop_supplicant(WIFI_DEVICE_ID);
 #else
         return wifi_stop_supplicant();
 #endif
-    case WIFI_CONNECT_SUPPLICANT:
-        return wifi_connect_to_supplicant(
-#if (SHORT_PLATFORM_VERSION > 40) && (SHORT_PLATFORM_VERSION < 44)
-                                          mInterface.string()
-#endif
-                                          );
+    case WIFI_CONNECT_SUPPLICANT: {
+        /* Only checks that the supplicant accepts connections; the
+           service opens its own monitor and command connections in
+           openMonitor().  wifi_connect_to_supplicant() would attach a
+           monitor of its own that nothing reads. */
+        char path[PROPERTY_VALUE_MAX + 64];
+        supplicantPath(path, sizeof(path));
+        struct wpa_ctrl *ctrl = wpa_ctrl_open(path);
+        if (!ctrl)
+            return -1;
+        wpa_ctrl_close(ctrl);
+        return 0;
+        }
     case WIFI_CLOSE_SUPPLICANT:
-        wifi_close_supplicant_connection(
-#if (SHORT_PLATFORM_VERSION > 40) && (SHORT_PLATFORM_VERSION < 44)
-                                         mInterface.string()
-#endif
-                                         );
+        closeMonitor();
         break;
-    case WIFI_WAIT_EVENT:
-        if (wifi_wait_for_event(
-#if (SHORT_PLATFORM_VERSION > 40) && (SHORT_PLATFORM_VERSION < 44)
-                                mInterface.string(), 
-#endif
-                                rbuf, sizeof(rbuf)) > 0) {
-            char *buf = rbuf;
-            int event = 0, len = 0;
-            while (1) {
-                len = strlen(event_map[event].name);
-                if (!strncmp(buf, event_map[event].name, len))
-                    break;
-                event++;
-                if (!event_map[event].name) {
-                    SLOGV(".....Unknown supplicant event: %s\n", buf);
-                    return 0;
-                }
-            }
-            buf += len;
-            event = event_map[event].event;
-            if (event != CTRL_EVENT_BSS_ADDED && event != CTRL_EVENT_BSS_REMOVED)
-                SLOGV(".....EVENT: '%s' event %s\n", rbuf, msgStr(event));
-            switch (event) {
-            case NETWORK_CONNECTION_EVENT: {
-                /* Regex pattern for extracting an Ethernet-style MAC address from a string.
-                 * Matches a strings like the following:
-                 * 'CTRL-EVENT-CONNECTED - Connection to 00:1e:58:ec:d5:6d completed (reauth) [id=1 id_str=]' */
-                char *p = buf;
-                while (*p != ' ' && *p)
-                    p++;
-                if (!*p) {
-                    SLOGV("......unable to find termination of mac address %s\n", buf);
-                    return 0;
-                }
-                String8 macaddr = String8(buf, p - buf);
-                buf = p;
-                while (*buf != '=' && *buf)
-                    buf++;
-                if (!*buf) {
-                    SLOGV(".....unable to find id= in %s\n", p);
-                    return 0;
-                }
-                p = ++buf;
-                while (isdigit(*p))
-                    p++;
-                if (*p != ' ')
-                    SLOGV(".....unable to find termination of id in %s\n", buf);
-                else
-                    enqueue(new Message(event, atoi(String8(buf, p-buf).string()), 0, macaddr));
-                break;
-                }
-            case SUP_STATE_CHANGE_EVENT: {
-                Vector<String8> items = splitString(buf, ' ');
-                String8 bssid;
-                int network_id = -1;
-                int new_state = -1;
-                for (size_t i = 0 ; i < items.size() ; i++) {
-                    Vector<String8> pair = splitString(items[i],'=');
-                    if (pair.size() != 2)
-                        continue;
-                    if (pair[0] == "BSSID")
-                        bssid = pair[1];
-                    else if (pair[0] == "id")
-                        network_id = atoi(pair[1].string());
-                    else if (pair[0] == "state")
-                        new_state = atoi(pair[1].string());
-                }
-                if (new_state == -1)
-                    break;
-                enqueue(new Message(event, network_id, new_state, bssid));
-                break;
-                }
-            case CTRL_EVENT_LINK_SPEED:
-            case CTRL_EVENT_DRIVER_STATE:
-            case CTRL_EVENT_EAP_FAILURE:
-            case CTRL_EVENT_BSS_ADDED:
-            case CTRL_EVENT_BSS_REMOVED:
+    case WIFI_WAIT_EVENT: {
+        if (!mMonitor)
+            return -1;
+        // Drain the monitor socket, so a scan storm costs one wakeup
+        // and a handful of messages rather than one per event
+        int fd = wpa_ctrl_get_fd(mMonitor);
+        SupplicantEventBatch batch(this);
+        for (int count = 0 ; count < MONITOR_BATCH_EVENTS && ret >= 0 ; count++) {
+            int pending = 0;
+            if (ioctl(fd, FIONREAD, &pending) == 0 && (size_t) pending >= mEventBuffer.size())
+                mEventBuffer.insertAt(0, mEventBuffer.size(), pending + 1 - mEventBuffer.size());
+            ssize_t len = recv(fd, mEventBuffer.editArray(), mEventBuffer.size() - 1, MSG_DONTWAIT);
+            if (len < 0 && errno == EINTR)
+                continue;
+            if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
                 break;
-            case NETWORK_DISCONNECTION_EVENT:
-            case SUP_SCAN_RESULTS_EVENT:
-            case AUTHENTICATION_FAILURE_EVENT:
-            case SUP_DISCONNECTION_EVENT:
-                enqueue(event);
+            if (len < 0) {
+                // Like wifi_wait_for_event(), treat a broken connection as termination
+                SLOGV(".....Supplicant monitor connection closed: %s\n", strerror(errno));
+                batch.post(new Message(SUP_DISCONNECTION_EVENT));
+                ret = -1;
                 break;
             }
+            char *buf = mEventBuffer.editArray();
+            buf[len] = 0;
+            // Strip the optional "IFNAME=xxx " and the "<N>" priority prefix
+            if (!strncmp(buf, "IFNAME=", 7)) {
+                char *p = strchr(buf, ' ');
+                if (p)
+                    buf = p + 1;
+            }
+            if (*buf == '<') {
+                char *p = strchr(buf, '>');
+                if (p)
+                    buf = p + 1;
+            }
+            ret = batch.add(buf);
+        }
+        batch.flush();
+        if (ret < 0)
+            closeMonitor();
+        break;
         }
     }
     return ret;
@@ -370,22 +313,14 @@ int WifiStateMachine::request_wifi(int request)
 String8 WifiStateMachine::doWifiStringCommand(const char *fmt, va_list args)
 {
     char buf[BUF_SIZE];
-    char reply[4096];
-    size_t reply_len = sizeof(reply) - 1;
     int byteCount = vsnprintf(buf, sizeof(buf), fmt, args);
-    SLOGV(".....Command: %s\n", buf);
-    if (byteCount < 0 || byteCount >= BUF_SIZE
-     || ::wifi_command(
-#if (SHORT_PLATFORM_VERSION > 40) && (SHORT_PLATFORM_VERSION < 44)
-                       mInterface.string(), 
-#endif
-                       buf, reply, &reply_len))
-        reply_len = 0;
-    if (reply_len > 0 && reply[reply_len-1] == '\n')
-        reply_len--;
-    reply[reply_len] = 0;
-    //SLOGV(".....Reply: %s\n", reply);
-    return String8(reply);
+    if (byteCount < 0 || byteCount >= BUF_SIZE)
+        return String8();
+    if (!mCommands.isOpen()) {
+        SLOGV(".....Command '%s' with no supplicant connection\n", buf);
+        return String8();
+    }
+    return mCommands.command(buf);
 }
 
 String8 WifiStateMachine::doWifiStringCommand(const char *fmt, ...)
@@ -417,48 +352,285 @@ static String8 removeDoubleQuotes(const String8 s)
     return s;
 }
 
-void WifiStateMachine::readNetworkVariables(ConfiguredStation& station)
+/* A station just added that could not be read back holds the values it
+   was configured with, the key masked as the supplicant would report
+   it, so that it is found (and not added twice) until the next
+   LIST_NETWORKS */
+static void setRequestedVariables(ConfiguredStation& station, const ConfiguredStation& cs)
 {
-    if (station.network_id < 0)
-        return;
-    String8 p = doWifiStringCommand("GET_NETWORK %d ssid", station.network_id);
-    if (p != "FAIL")
-        station.ssid = removeDoubleQuotes(p);
-    p = doWifiStringCommand("GET_NETWORK %d priority", station.network_id);
-    if (p != "FAIL")
-        station.priority = atoi(p.string());
-    p = doWifiStringCommand("GET_NETWORK %d key_mgmt", station.network_id);
-    if (p != "FAIL")
-        station.key_mgmt = p;
-    else
-        station.key_mgmt = "NONE";
-    p = doWifiStringCommand("GET_NETWORK %d psk", station.network_id);
-    if (p != "FAIL")
-        station.pre_shared_key = p;
+    station.ssid = cs.ssid;
+    station.priority = cs.priority;
+    station.key_mgmt = cs.key_mgmt;
+    station.pre_shared_key = cs.pre_shared_key.isEmpty() ? String8() : String8("*");
+}
+
+bool WifiStateMachine::readNetworkVariables(ConfiguredStation& station)
+{
+    return readNetworkVariables(&station, 1) == 1;
+}
+
+/* One pipelined exchange; returns how many replies arrived, the rest
+   are empty (all of them with no supplicant connection) */
+size_t WifiStateMachine::exchangeCommands(const Vector<String8>& commands, Vector<String8>& replies)
+{
+    return mCommands.exchange(commands, replies);
+}
+
+/* Read the variables of all the stations in one pipelined exchange.
+   Returns how many stations, from the first, were read; if replies
+   went missing the rest are left untouched. */
+size_t WifiStateMachine::readNetworkVariables(ConfiguredStation *stations, size_t count)
+{
+    static const char *variables[] = { "ssid", "priority", "key_mgmt", "psk" };
+    static const size_t VARIABLES = sizeof(variables) / sizeof(variables[0]);
+    Vector<String8> commands, replies;
+
+    commands.setCapacity(count * VARIABLES);
+    for (size_t i = 0 ; i < count ; i++) {
+        for (size_t j = 0 ; j < VARIABLES ; j++) {
+            String8 command;
+            command.appendFormat("GET_NETWORK %d %s", stations[i].network_id, variables[j]);
+            commands.push(command);
+        }
+    }
+    size_t read = exchangeCommands(commands, replies) / VARIABLES;
+    if (read < count)
+        SLOGW("......readNetworkVariables: no reply for network %d\n", stations[read].network_id);
+    for (size_t i = 0 ; i < read ; i++) {
+        ConfiguredStation& station(stations[i]);
+        const String8 *p = &replies[i * VARIABLES];
+        if (station.network_id < 0)
+            continue;
+        if (p[0] != "FAIL")
+            station.ssid = removeDoubleQuotes(p[0]);
+        if (p[1] != "FAIL")
+            station.priority = atoi(p[1].string());
+        station.key_mgmt = (p[2] != "FAIL") ? p[2] : String8("NONE");
+        if (p[3] != "FAIL")
+            station.pre_shared_key = p[3];
+    }
+    return read;
+}
+
+static void updateBss(const BssRecord& bss, void *data)
+{
+    static_cast<BssTable *>(data)->update(bss);
+}
+
+/*
+  Bring mBssTable up to date after a scan.  BSSs reported by
+  CTRL-EVENT-BSS-ADDED since the last scan are read in one pipelined
+  exchange; removed ones were dropped as their events arrived.  The
+  supplicant updates the signal level of known BSSs without an event,
+  so the whole table is read again every BSS_RECONCILE_INTERVAL_MSECS.
+  From 4.4 the table is paged through with BSS RANGE, so dense
+  environments are not cut off at the reply size; before that
+  SCAN_RESULTS is read in full every time.
+ */
+void WifiStateMachine::updateBssTable(void)
+{
+#if (SHORT_PLATFORM_VERSION >= 44)
+    nsecs_t now = systemTime();
+    if (mCommands.isOpen() && mBssReconcileTime
+     && now - mBssReconcileTime < ms2ns(BSS_RECONCILE_INTERVAL_MSECS)) {
+        Vector<String8> commands, replies;
+        for (size_t i = 0 ; i < mAddedBss.size() ; i++) {
+            String8 command;
+            command.appendFormat("BSS ID-%d MASK=0x21987", mAddedBss[i]);
+            commands.push(command);
+        }
+        mAddedBss.clear();
+        if (mCommands.exchange(commands, replies) == commands.size()) {
+            for (size_t i = 0 ; i < replies.size() ; i++) {
+                int lastId;
+                parseBssPage(replies[i], updateBss, &mBssTable, &lastId);
+            }
+            return;
+        }
+    }
+    mAddedBss.clear();
+    mBssTable.beginReconcile();
+    if (mCommands.isOpen()) {
+        char command[64];
+        char reply[SupplicantChannel::REPLY_SIZE];
+        int next = 0;
+        ssize_t len;
+        for (;;) {
+            // id, bssid, freq, level, tsf, flags, ssid and the "====" delimiter
+            snprintf(command, sizeof(command), "BSS RANGE=%d- MASK=0x21987", next);
+            len = mCommands.request(command, reply, sizeof(reply));
+            if (len <= 0 || !strncmp(reply, "FAIL", 4))
+                break;
+            int lastId = -1;
+            if (!parseBssPage(reply, updateBss, &mBssTable, &lastId)) {
+                SLOGW("......updateBssTable() no complete entry in page at %d\n", next);
+                break;
+            }
+            next = lastId + 1;
+        }
+        // Only a read that paged through to the empty page at the end
+        // has seen every BSS.  A failure part way keeps the entries it
+        // did not reach, and the next scan reconciles again.
+        if (len == 0) {
+            mBssTable.endReconcile();
+            mBssReconcileTime = now;
+            return;
+        }
+        if (next > 0) {
+            SLOGW("......updateBssTable() reconcile abandoned at %d\n", next);
+            return;
+        }
+    }
+#else
+    mBssTable.beginReconcile();
+#endif
+    String8 data = doWifiStringCommand("SCAN_RESULTS");
+    parseScanResults(data, updateBss, &mBssTable);
+    mBssTable.endReconcile();
+}
+
+/*
+  Read the supplicant's network list.  One LIST_NETWORKS reply is cut
+  off at the reply size, so where the supplicant takes LAST_ID= the
+  list is read a page at a time, each starting after the last complete
+  line of the one before.  A trailing line cut off without its newline
+  is never used.  Returns the network lines without the header.
+ */
+String8 WifiStateMachine::listNetworks(void)
+{
+    char command[64];
+    char reply[SupplicantChannel::REPLY_SIZE];
+    String8 list;
+    int lastId = -1;
+    bool paged = true;
+
+    for (;;) {
+        if (paged)
+            snprintf(command, sizeof(command), "LIST_NETWORKS LAST_ID=%d", lastId);
+        else
+            strcpy(command, "LIST_NETWORKS");
+        bool newline;
+        ssize_t len = mCommands.request(command, reply, sizeof(reply), &newline);
+        if (len < 0)
+            break;
+        if (paged && (!strncmp(reply, "FAIL", 4) || !strncmp(reply, "UNKNOWN COMMAND", 15))) {
+            paged = false;      // An older supplicant: one reply, whatever fits
+            continue;
+        }
+        const char *end = newline ? reply + len : strrchr(reply, '\n');
+        if (!end)
+            break;
+        StringTokenizer lines(StringSpan(reply, end - reply), '\n');
+        StringSpan line;
+        lines.next(&line);      // The first line is a header
+        int id = lastId;
+        while (lines.next(&line)) {
+            id = line.toInt();
+            if (!list.isEmpty())
+                list.append("\n");
+            list.append(line.data, line.length);
+        }
+        if (!paged || id <= lastId)
+            break;
+        lastId = id;
+    }
+    return list;
+}
+
+static int monitor_cb(int fd, int events, void *arg)
+{
+    WifiStateMachine *wsm = static_cast<WifiStateMachine *>(arg);
+    return wsm->request_wifi(WifiStateMachine::WIFI_WAIT_EVENT) >= 0;
 }
 
 /*
   The WifiStateMachine watches for supplicant messages about wifi
-  state and posts them to the state machine.  It runs in its own thread.
+  state and posts them to the state machine.  The monitor socket is
+  serviced on the state machine thread itself (see monitor_cb).
   This is strongly based on WifiStateMachine.java.
  */
-static int monitorThread(void *arg)
+void WifiStateMachine::supplicantPath(char *path, size_t size) const
+{
+    if (access(SUPPLICANT_IFACE_DIR, F_OK) == 0)
+        snprintf(path, size, "%s/%s", SUPPLICANT_IFACE_DIR, mInterface.string());
+    else
+#if (SHORT_PLATFORM_VERSION == 23)
+        snprintf(path, size, "%s", mInterface.string());
+#else
+        snprintf(path, size, "@android:wpa_%s", mInterface.string());
+#endif
+}
+
+void WifiStateMachine::openMonitor(void)
+{
+    char path[PROPERTY_VALUE_MAX + 64];
+
+    closeMonitor();
+    supplicantPath(path, sizeof(path));
+    mMonitor = wpa_ctrl_open(path);
+    if (!mMonitor || wpa_ctrl_attach(mMonitor)
+     || addFd(wpa_ctrl_get_fd(mMonitor), EPOLLIN, monitor_cb, this)
+     || !mCommands.open(path)) {
+        SLOGW("Unable to open supplicant connections '%s'\n", path);
+        closeMonitor();
+        enqueue(SUP_DISCONNECTION_EVENT);
+        return;
+    }
+    SLOGV("........#### Supplicant monitor attached ####\n");
+}
+
+void WifiStateMachine::closeMonitor(void)
+{
+    mCommands.close();
+    if (!mMonitor)
+        return;
+    removeFd(wpa_ctrl_get_fd(mMonitor));
+    wpa_ctrl_close(mMonitor);
+    mMonitor = NULL;
+}
+
+// ------------------------------------------------------------
+// Blocking operations, run on the state machine's worker thread
+
+static Message *dhcpJob(void *arg, int generation)
+{
+    return static_cast<WifiStateMachine *>(arg)->dhcp_request(generation);
+}
+
+static Message *loadDriverJob(void *arg, int)
+{
+    WifiStateMachine *wsm = static_cast<WifiStateMachine *>(arg);
+    if (wsm->request_wifi(WifiStateMachine::WIFI_LOAD_DRIVER))
+        return new Message(CMD_LOAD_DRIVER_FAILURE);
+    return new Message(CMD_LOAD_DRIVER_SUCCESS);
+}
+
+static Message *unloadDriverJob(void *arg, int)
+{
+    WifiStateMachine *wsm = static_cast<WifiStateMachine *>(arg);
+    if (wsm->request_wifi(WifiStateMachine::WIFI_UNLOAD_DRIVER))
+        return new Message(CMD_UNLOAD_DRIVER_FAILURE);
+    return new Message(CMD_UNLOAD_DRIVER_SUCCESS);
+}
+
+/*
+  Start the supplicant and connect to it.  A freshly started supplicant
+  can take a few tries to accept connections.  Any failure is reported
+  as SUP_DISCONNECTION_EVENT, which retries and eventually unloads the
+  driver.
+ */
+static Message *startSupplicantJob(void *arg, int)
 {
     WifiStateMachine *wsm = static_cast<WifiStateMachine *>(arg);
-    SLOGV("........#### Starting monitor thread ####\n");
+    if (wsm->request_wifi(WifiStateMachine::WIFI_START_SUPPLICANT))
+        return new Message(SUP_DISCONNECTION_EVENT);
     int i = 0;
-    char buf[BUF_SIZE];  // Will store a UTF string
     while (wsm->request_wifi(WifiStateMachine::WIFI_CONNECT_SUPPLICANT)) {
-        if (++i > 5) {
-            wsm->enqueue(SUP_DISCONNECTION_EVENT);
-            return -1;
-        }
+        if (++i > 5)
+            return new Message(SUP_DISCONNECTION_EVENT);
         usleep(250 * 1000);  // Sleep for 250 ms
     }
-    wsm->enqueue(SUP_CONNECTION_EVENT);
-    while (wsm->request_wifi(WifiStateMachine::WIFI_WAIT_EVENT) <= 0)
-        ;
-    return 0;
+    return new Message(SUP_CONNECTION_EVENT);
 }
 
 void WifiStateMachine::setInterfaceState(int astate) 
@@ -478,16 +650,8 @@ void WifiStateMachine::setInterfaceState(int astate)
     if (code < 0) 
         SLOGE("Failed to extract valid code from '%s'", data.string());
     else {
-        int s = extractSequence(data.string() + 4);
-        if (s < 0)
-            SLOGE("Failed to extract valid sequence from '%s'", data.string());
-        else if (s != seqno)
-            SLOGE("Sequence mismatch %d (should be %d)", s, seqno);
-        else {
-            SLOGV(".....WifiStateMachine::response: %d", code);
-            if (code > 0)
-                response.push(data);
-        }
+        SLOGV(".....WifiStateMachine::response: %d", code);
+        response.push(data);
     }
     if (code != 213 || response.size() == 0) {
         SLOGW("...can't get interface config code=%d\n", code);
@@ -519,60 +683,261 @@ static void restartSupplicant(WifiStateMachine *wsm)
 {
     SLOGD("Restarting supplicant\n");
     wsm->request_wifi(WifiStateMachine::WIFI_STOP_SUPPLICANT);
-    wsm->enqueueDelayed(CMD_START_SUPPLICANT, SUPPLICANT_RESTART_INTERVAL_MSECS);
+    wsm->replaceDelayed(CMD_START_SUPPLICANT, SUPPLICANT_RESTART_INTERVAL_MSECS);
 }
 
 int WifiStateMachine::findIndexByNetworkId(int network_id)
 {
-    for (size_t i = 0 ; i < mStationsConfig.size() ; i++)
-        if (mStationsConfig[i].network_id == network_id)
-            return i;
+    ssize_t index = mStationsConfig.indexOfNetworkId(network_id);
+    if (index >= 0)
+        return index;
     SLOGW("......findIndexByNetworkId: network %d doesn't exist\n", network_id);
     return -1;
 }
 
 void WifiStateMachine::setStatus(const char *command, int network_id, ConfiguredStation::Status astatus)
 {
-    Mutex::Autolock _l(mReadLock);
     if (doWifiBooleanCommand(command, network_id)) {
-        for (size_t i = 0 ; i < mStationsConfig.size() ; i++) {
-            ConfiguredStation& station(mStationsConfig.editItemAt(i));
-            if (station.network_id == network_id) {
-                if (strncmp(command, "REMOVE_NETWORK", strlen("REMOVE_NETWORK")))
-                    station.status = astatus;
-                else {
-                    int status = mStationsConfig.itemAt(i).status;
-                    mStationsConfig.removeAt(i);
-                    if (status == ConfiguredStation::CURRENT) {
-                        /* Enable other networks if we remove the active network */
-                        for (size_t i = 0 ; i < mStationsConfig.size() ; i++) {
-                            ConfiguredStation& cs = mStationsConfig.editItemAt(i);
-                            if (cs.status == ConfiguredStation::DISABLED && 
-                                doWifiBooleanCommand("ENABLE_NETWORK %d", cs.network_id)) {
-                                cs.status = ConfiguredStation::ENABLED;
-                            }
-                        }
-                    }
-                    break;
+        ssize_t index = mStationsConfig.indexOfNetworkId(network_id);
+        if (!strncmp(command, "REMOVE_NETWORK", strlen("REMOVE_NETWORK"))) {
+            if (index >= 0) {
+                int status = mStationsConfig[index].status;
+                mStationsConfig.removeAt(index);
+                /* Enable other networks if we remove the active network */
+                if (status == ConfiguredStation::CURRENT)
+                    enableDisabledNetworks();
+            }
+            saveConfigLater();
+        }
+        else {
+            if (index >= 0)
+                mStationsConfig.editItemAt(index).status = astatus;
+            if (!strncmp(command, "SELECT_NETWORK", strlen("SELECT_NETWORK"))) {
+                for (size_t i = 0 ; i < mStationsConfig.size() ; i++) {
+                    if ((ssize_t) i != index)
+                        mStationsConfig.editItemAt(i).status = ConfiguredStation::DISABLED;
                 }
             }
-            else if (!strncmp(command, "SELECT_NETWORK", strlen("SELECT_NETWORK")))
-                station.status = ConfiguredStation::DISABLED;
         }
-        if (!strncmp(command, "REMOVE_NETWORK", strlen("REMOVE_NETWORK"))) {
-            doWifiBooleanCommand("AP_SCAN 1");
-            doWifiBooleanCommand("SAVE_CONFIG");
+    }
+    publishStations();
+}
+
+void WifiStateMachine::enableDisabledNetworks()
+{
+    for (size_t i = 0 ; i < mStationsConfig.size() ; i++) {
+        ConfiguredStation& cs = mStationsConfig.editItemAt(i);
+        if (cs.status == ConfiguredStation::DISABLED && 
+            doWifiBooleanCommand("ENABLE_NETWORK %d", cs.network_id)) {
+            cs.status = ConfiguredStation::ENABLED;
         }
     }
-    mService->BroadcastConfiguredStations(mStationsConfig);
+}
+
+/*
+  Apply a batch of network changes from a provisioning client.  Each
+  step (remove, add, configure, read back) is a single pipelined
+  exchange with the supplicant rather than a round trip per command,
+  and the result is saved and broadcast once.  Unlike CMD_ADD_OR_UPDATE_NETWORK
+  no network is selected: new networks are simply enabled.  A new
+  network that cannot be configured is removed again; a failed update
+  leaves whatever the supplicant accepted, as read back.
+ */
+void WifiStateMachine::updateNetworks(const Vector<ConfiguredStation>& updates,
+                                      const Vector<int>& removals)
+{
+    Vector<String8> commands, replies;
+    bool changed = false;
+
+    if (removals.size()) {
+        Vector<int> removed;
+        bool removedCurrent = false;
+        for (size_t i = 0 ; i < removals.size() ; i++)
+            commands.push(String8::format("REMOVE_NETWORK %d", removals[i]));
+        exchangeCommands(commands, replies);
+        for (size_t i = 0 ; i < removals.size() ; i++) {
+            if (replies[i] != "OK") {
+                SLOGW("......updateNetworks: unable to remove network %d\n", removals[i]);
+                continue;
+            }
+            ssize_t index = mStationsConfig.indexOfNetworkId(removals[i]);
+            if (index >= 0 && mStationsConfig[index].status == ConfiguredStation::CURRENT)
+                removedCurrent = true;
+            removed.push(removals[i]);
+        }
+        mStationsConfig.removeNetworks(removed);
+        if (removedCurrent)
+            enableDisabledNetworks();
+        changed = removed.size() > 0;
+    }
+
+    /* Stations to apply, with their index in mStationsConfig (-1 for
+       new ones) and supplicant network id (-1 once they have failed) */
+    Vector<ConfiguredStation> stations;
+    Vector<ssize_t> indexes;
+    Vector<int> ids;
+    KeyedVector<String8, bool> added;   // SSIDs new in this batch
+    commands.clear();
+    for (size_t i = 0 ; i < updates.size() ; i++) {
+        const ConfiguredStation& cs = updates[i];
+        ssize_t index = -1;
+        if (cs.network_id != -1) {
+            index = findIndexByNetworkId(cs.network_id);
+            if (index < 0)
+                continue;
+        }
+        else if (mStationsConfig.indexOfSsid(cs.ssid) >= 0 || added.indexOfKey(cs.ssid) >= 0) {
+            SLOGW("......updateNetworks: Attempting to add ssid=%s"
+                  " but that station already exists\n", cs.ssid.string());
+            continue;
+        }
+        else {
+            added.add(cs.ssid, true);
+            commands.push(String8("ADD_NETWORK"));
+        }
+        stations.push(cs);
+        indexes.push(index);
+        ids.push(cs.network_id);
+    }
+    if (stations.isEmpty())
+        goto done;
+
+    if (commands.size()) {
+        exchangeCommands(commands, replies);
+        for (size_t i = 0, reply = 0 ; i < stations.size() ; i++) {
+            if (indexes[i] != -1)
+                continue;
+            const String8& s = replies[reply++];
+            if (s.isEmpty() || !isdigit(s.string()[0])) {
+                SLOGW("......updateNetworks: Failed to add a network [%s]\n", s.string());
+                continue;
+            }
+            ids.editItemAt(i) = atoi(s.string());
+        }
+    }
+
+    /* Configure the SSID, key management, pre-shared key and priority;
+       'owner' maps each command back to its station */
+    {
+    Vector<size_t> owner;
+    commands.clear();
+    for (size_t i = 0 ; i < stations.size() ; i++) {
+        const ConfiguredStation& cs = stations[i];
+        int id = ids[i];
+        if (id < 0)
+            continue;
+        commands.push(String8::format("SET_NETWORK %d ssid \"%s\"", id, cs.ssid.string()));
+        owner.push(i);
+        if (!cs.key_mgmt.isEmpty()) {
+            commands.push(String8::format("SET_NETWORK %d key_mgmt %s", id, cs.key_mgmt.string()));
+            owner.push(i);
+        }
+        if (!cs.pre_shared_key.isEmpty() && cs.pre_shared_key != "*") {
+            commands.push(String8::format("SET_NETWORK %d psk \"%s\"", id, cs.pre_shared_key.string()));
+            owner.push(i);
+        }
+        commands.push(String8::format("SET_NETWORK %d priority %d", id, cs.priority));
+        owner.push(i);
+        if (indexes[i] == -1) {
+            commands.push(String8::format("ENABLE_NETWORK %d", id));
+            owner.push(i);
+        }
+    }
+    exchangeCommands(commands, replies);
+    commands.clear();
+    for (size_t i = 0 ; i < replies.size() ; i++) {
+        size_t k = owner[i];
+        if (replies[i] == "OK" || indexes[k] != -1 || ids[k] < 0)
+            continue;
+        SLOGW("......updateNetworks: unable to configure ssid=%s\n", stations[k].ssid.string());
+        commands.push(String8::format("REMOVE_NETWORK %d", ids[k]));
+        ids.editItemAt(k) = -1;
+    }
+    if (commands.size())
+        exchangeCommands(commands, replies);
+    }
+
+    /* Read the configuration back from the supplicant, as for a
+       single update, so clients see what it actually holds */
+    {
+    Vector<ConfiguredStation> result;
+    Vector<size_t> owner;
+    for (size_t i = 0 ; i < stations.size() ; i++) {
+        if (ids[i] < 0)
+            continue;
+        ConfiguredStation station;
+        if (indexes[i] != -1)
+            station = mStationsConfig[indexes[i]];
+        else
+            station.status = ConfiguredStation::ENABLED;
+        station.network_id = ids[i];
+        result.push(station);
+        owner.push(i);
+    }
+    // Stations that could not be read back keep their old entry, or
+    // the values they were given if they are new
+    size_t read = 0;
+    if (result.size())
+        read = readNetworkVariables(result.editArray(), result.size());
+    for (size_t i = 0 ; i < result.size() ; i++) {
+        ssize_t index = indexes[owner[i]];
+        if (index != -1) {
+            if (i < read)
+                mStationsConfig.replaceAt(index, result[i]);
+            continue;
+        }
+        if (i >= read)
+            setRequestedVariables(result.editItemAt(i), stations[owner[i]]);
+        mStationsConfig.add(result[i]);
+    }
+    changed = changed || result.size() > 0;
+    }
+
+done:
+    if (changed)
+        saveConfigLater();
+    publishStations();
+}
+
+/* Changes to the configured networks are not written to the supplicant
+   configuration file one at a time: the save waits until the changes
+   stop for SAVE_CONFIG_DELAY_MSECS, or at most SAVE_CONFIG_MAX_DELAY_MSECS.
+   flushConfig() writes a pending save at once; it is called before the
+   supplicant is stopped. */
+void WifiStateMachine::saveConfigLater()
+{
+    nsecs_t now = systemTime();
+    if (!mSavePending) {
+        mSavePending = true;
+        mSaveDeadline = now + ms2ns(SAVE_CONFIG_MAX_DELAY_MSECS);
+    }
+    int delay = SAVE_CONFIG_DELAY_MSECS;
+    int remaining = ns2ms(mSaveDeadline - now);
+    if (remaining < delay)
+        delay = remaining > 0 ? remaining : 0;
+    replaceDelayed(CMD_SAVE_CONFIG, delay);
+}
+
+void WifiStateMachine::flushConfig()
+{
+    if (!mSavePending)
+        return;
+    removeDelayed(CMD_SAVE_CONFIG);
+    mSavePending = false;
+    doWifiBooleanCommand("AP_SCAN 1");
+    if (!doWifiBooleanCommand("SAVE_CONFIG"))
+        SLOGW("Unable to save the supplicant configuration\n");
 }
 
 void WifiStateMachine::disable_interface(void)
 {
+    removeDelayed(CMD_RSSI_POLL);
+    mDhcpGeneration++;      // Drop the result of any DHCP request in progress
+    mProvisionalIp = false;
+    mSignalMonitor.reset();
     request_wifi(DHCP_STOP);
-    ncommand("interface clearaddrs %s", mInterface.string());
+    mNetd.post(netdReply, NULL, "interface clearaddrs %s", mInterface.string());
     // Update the Wifi Information visible to the user
-    Mutex::Autolock _l(mReadLock);
     mWifiInformation.ipaddr = "";
     mWifiInformation.bssid = "";
     mWifiInformation.ssid = "";
@@ -581,14 +946,28 @@ void WifiStateMachine::disable_interface(void)
     mWifiInformation.supplicant_state = WPA_INTERFACE_DISABLED;
 #endif
     mWifiInformation.rssi = -9999;
+    mInformationRssi = -9999;
     mWifiInformation.link_speed = -1;
-    mService->BroadcastInformation(mWifiInformation);
+    publishInformation();
     for (size_t i = 0 ; i < mStationsConfig.size() ; i++) {
         ConfiguredStation& cs = mStationsConfig.editItemAt(i);
         if (cs.status == ConfiguredStation::CURRENT)
             cs.status = ConfiguredStation::ENABLED;
     }
-    mService->BroadcastConfiguredStations(mStationsConfig);
+    publishStations();
+}
+
+/* If a scan is already running, its SUP_SCAN_RESULTS_EVENT broadcast
+   answers this request as well.  Checked by the states that scan, so
+   the other states still defer or transition on CMD_START_SCAN. */
+bool WifiStateMachine::attachToPendingScan()
+{
+    if ((mScanResultIsPending || mSupplicantScanning)
+     && systemTime() - mScanStartTime < ms2ns(SCAN_PENDING_TIMEOUT_MSECS)) {
+        SLOGV("......Scan request attached to pending scan\n");
+        return true;
+    }
+    return false;
 }
 
 void WifiStateMachine::start_scan(bool aactive)
@@ -599,6 +978,7 @@ void WifiStateMachine::start_scan(bool aactive)
     if (aactive)
         doWifiBooleanCommand("DRIVER SCAN-PASSIVE");
     mScanResultIsPending = true;
+    mScanStartTime = systemTime();
 }
 
 static bool fixDnsEntry(const char *key, const char *value)
@@ -612,13 +992,129 @@ static bool fixDnsEntry(const char *key, const char *value)
     return false;
 }
 
-static int network_cb(void *arg)
+void WifiStateMachine::setDnsServers(const char *dns1, const char *dns2)
 {
-    WifiStateMachine *wsm = static_cast<WifiStateMachine *>(arg);
+    // Update property system with DNS data for the resolver
+    if (fixDnsEntry("net.dns1", dns1) || fixDnsEntry("net.dns2", dns2)) {
+        // ### TODO: Check to make sure they aren't local addresses
+        if (!strcmp(dns1, "127.0.0.1"))
+            dns1 = "";
+        if (!strcmp(dns2, "127.0.0.1"))
+            dns2 = "";
+#if (SHORT_PLATFORM_VERSION == 43)
+        mNetd.post(netdReply, NULL, "resolver setifdns %s %s %s %s", mInterface.string(), "", dns1, dns2);
+#else
+        mNetd.post(netdReply, NULL, "resolver setifdns %s %s %s", mInterface.string(), dns1, dns2);
+#endif
+        mNetd.post(netdReply, NULL, "resolver setifdns %s", mInterface.string());
+    }
+}
+
+/* Publish an IP configuration.  dhcpcd configures the address of the
+   leases it obtains; 'setAddress' is for addresses it has not (yet). */
+void WifiStateMachine::configureIp(const DhcpLease& lease, bool setAddress, bool cached)
+{
+    if (setAddress)
+        mNetd.post(netdReply, NULL, "interface setcfg %s %s %d up", mInterface.string(),
+                   lease.ipaddr.string(), lease.prefixLength);
+    // Set a default route
+    mNetd.post(netdReply, NULL, "interface route add %s default 0.0.0.0 0 %s",
+               mInterface.string(), lease.gateway.string());
+    setDnsServers(lease.dns1.string(), lease.dns2.string());
+    if (mWifiInformation.ipaddr.isEmpty()) {
+        Mutex::Autolock _l(mReadLock);
+        mConnectToIp[cached ? 1 : 0].add(mConnectTime);
+    }
+    mWifiInformation.ipaddr = lease.ipaddr;
+    publishInformation();
+    scheduleRssiPoll(mSignalMonitor.interval());
+}
+
+/* Take down the default route configureIp() added for a cached lease
+   that dhcpcd did not confirm */
+void WifiStateMachine::removeProvisionalRoute(void)
+{
+    mNetd.post(netdReply, NULL, "interface route remove %s default 0.0.0.0 0 %s",
+               mInterface.string(), mProvisionalLease.gateway.string());
+}
+
+/* There is nothing to poll until we have an address on an access
+   point; disable_interface() and DHCP failure clear the address, and
+   the poll that is already queued then lapses. */
+bool WifiStateMachine::rssiPollActive() const
+{
+    return mEnableRssiPolling && !mWifiInformation.ipaddr.isEmpty();
+}
+
+void WifiStateMachine::scheduleRssiPoll(int interval)
+{
+    if (rssiPollActive())
+        replaceDelayed(CMD_RSSI_POLL, interval);
+}
+
+/* A new signal level from SIGNAL_POLL or CTRL-EVENT-SIGNAL-CHANGE.
+   WifiService applies each client's hysteresis to the Rssi broadcast;
+   Information only goes out when something else changed or the signal
+   moved noticeably. */
+void WifiStateMachine::updateSignal(int rssi, int link_speed, bool fromEvent)
+{
+    int interval = mSignalMonitor.sample(rssi, fromEvent);
+    bool changed = false;
+    mWifiInformation.rssi = rssi;
+    mService->BroadcastRssi(rssi);
+    if (link_speed != -1 && link_speed != mWifiInformation.link_speed) {
+        mWifiInformation.link_speed = link_speed;
+        mService->BroadcastLinkSpeed(link_speed);
+        changed = true;
+    }
+    // Losing or regaining the signal is a change; no signal twice is not
+    bool lost = (rssi == -9999) != (mInformationRssi == -9999);
+    if (changed || lost || (rssi != -9999
+     && abs(rssi - mInformationRssi) >= INFORMATION_RSSI_STEP_DB)) {
+        mInformationRssi = rssi;
+        publishInformation();
+    }
+    // An event pushes the next poll out
+    scheduleRssiPoll(interval);
+}
+
+void WifiStateMachine::ConnectTiming::add(nsecs_t start)
+{
+    if (!start)
+        return;
+    int msecs = (int) ns2ms(systemTime() - start);
+    if (!count || msecs < minMsecs)
+        minMsecs = msecs;
+    if (!count || msecs > maxMsecs)
+        maxMsecs = msecs;
+    lastMsecs = msecs;
+    totalMsecs += msecs;
+    count++;
+}
+
+static void dumpTiming(String8& out, const char *name, const WifiStateMachine::ConnectTiming& timing)
+{
+    if (!timing.count) {
+        out.appendFormat("  %-24s none\n", name);
+        return;
+    }
+    out.appendFormat("  %-24s %d, last %dms, min %dms, avg %dms, max %dms\n", name, timing.count,
+                     timing.lastMsecs, timing.minMsecs, (int) (timing.totalMsecs / timing.count),
+                     timing.maxMsecs);
+}
 
-    while (!wsm->process_indication())
-        ;
-    return 0;
+void WifiStateMachine::dumpConnectTimes(String8& out)
+{
+    Mutex::Autolock _l(mReadLock);
+    out.append("Connect to IP address:\n");
+    dumpTiming(out, "DHCP", mConnectToIp[0]);
+    dumpTiming(out, "cached lease", mConnectToIp[1]);
+    dumpTiming(out, "DHCP complete", mConnectToLease);
+}
+
+static int network_cb(int fd, int events, void *arg)
+{
+    return static_cast<NetdClient *>(arg)->process();
 }
 // ------------------------------------------------------------
 WifiStateMachine::WifiStateMachine(const char *interface, WifiService *servicep)
@@ -626,44 +1122,72 @@ WifiStateMachine::WifiStateMachine(const char *interface, WifiService *servicep)
     , mEnableRssiPolling(true)
     , mEnableBackgroundScan(false)
     , mScanResultIsPending(false)
+    , mSupplicantScanning(false)
+    , mScanStartTime(0)
+    , mDhcpGeneration(0)
+    , mBssReconcileTime(0)
+    , mLeaseCache(DHCP_LEASE_CACHE_PATH)
+    , mProvisionalIp(false)
+    , mConnectTime(0)
+    , mInformationRssi(-9999)
+    , mSavePending(false)
+    , mSaveDeadline(0)
     , mService(servicep)
+    , mMonitor(NULL)
 {
-    initstates();
-    mSequenceNumber = 0;
-    indication_start = 0;
-    mFd = socket_local_client("netd", ANDROID_SOCKET_NAMESPACE_RESERVED, SOCK_STREAM);
-    if (mFd < 0) {
-        SLOGW("Could not start connection to socket %s due to error %d\n", "netd", mFd);
+    mEventBuffer.insertAt(0, 0, MONITOR_BUFFER_SIZE);
+    // Clients may register before anything has changed
+    mPublishedInformation.publish(mWifiInformation);
+    mPublishedStations.publish(mStationsConfig.stations());
+    mLeaseCache.load();
+    if (!mNetd.open("netd"))
         exit(1);
-    }
+    mNetd.subscribe(netdEvent, this);
     request_wifi(DHCP_STOP);
     request_wifi(WIFI_STOP_SUPPLICANT);
     if (request_wifi(WIFI_IS_DRIVER_LOADED))
         transitionTo(DRIVER_LOADED_STATE);
     else
         transitionTo(DRIVER_UNLOADED_STATE);
-    /* Connect to a CommandListener daemon (e.g. netd)
-      This is a simplified bit of code which expects to only be
-      called by a SINGLE thread (no multiplexing of requests from multiple threads).  */
-    androidCreateThread(network_cb, this);
+    /* The CommandListener daemon (netd) connection is serviced on the
+       state machine thread; commands are multiplexed on it by sequence
+       number, so several can be outstanding.  */
+    addFd(mNetd.fd(), EPOLLIN, network_cb, &mNetd);
+    setHandlerBudget(HANDLER_BUDGET_MSECS);
     SLOGV("...................WifiStateMachine::startRunning()\n");
     status_t result = run("WifiStateMachine", PRIORITY_NORMAL);
     LOG_ALWAYS_FATAL_IF(result, "Could not start WifiStateMachine thread due to error %d\n", result);
     SLOGV("...................WifiStateMachine::statemachine running()\n");
 }
 
+/* Called on a binder thread.  It reads the published snapshots, so it
+   never waits for the state machine (which may be in the middle of a
+   slow supplicant exchange). */
 void WifiStateMachine::Register(const sp<IWifiClient>& client, int flags)
 {
-    Mutex::Autolock _l(mReadLock);
-
     // We don't preemptively send scandata - it's probably old anyways
     if (flags & WIFI_CLIENT_FLAG_CONFIGURED_STATIONS)
-        client->ConfiguredStations(mStationsConfig);
+        client->ConfiguredStations(mPublishedStations.get()->value);
     if (flags & WIFI_CLIENT_FLAG_INFORMATION)
-        client->Information(mWifiInformation);
+        client->Information(mPublishedInformation.get()->value);
     // We don't preemptively send rssi or link speed data
 }
 
+/* The snapshot is published before the broadcast: a client registering
+   concurrently either reads the new value or is registered in time to
+   receive the broadcast. */
+void WifiStateMachine::publishInformation()
+{
+    mPublishedInformation.publish(mWifiInformation);
+    mService->BroadcastInformation(mWifiInformation);
+}
+
+void WifiStateMachine::publishStations()
+{
+    mPublishedStations.publish(mStationsConfig.stations());
+    mService->BroadcastConfiguredStations(mStationsConfig.stations());
+}
+
 static bool isConnecting(int state)
 {
     switch (state) {
@@ -679,19 +1203,75 @@ static bool isConnecting(int state)
 
 void WifiStateMachine::handleSupplicantStateChange(Message *message)
 {
-    Mutex::Autolock _l(mReadLock);
     mWifiInformation.supplicant_state = message->arg2();
     mWifiInformation.network_id = -1;
     if (isConnecting(mWifiInformation.supplicant_state))
         mWifiInformation.network_id = message->arg1();
     if (mWifiInformation.supplicant_state == WPA_ASSOCIATING)
         mWifiInformation.bssid = message->string();
-    mService->BroadcastInformation(mWifiInformation);
+    publishInformation();
 }
 
 const char * WifiStateMachine::msgStr(int msg_id)
 {
-    return sMessageToString[msg_id];
+    return sWifiStates.eventName(msg_id);
+}
+
+const char * WifiStateMachine::stateStr(int state)
+{
+    return sWifiStates.stateName(state);
+}
+
+/* Supplicant events first, so connect/disconnect handling never waits
+   behind a pile of client commands; then results of our own requests,
+   then client commands, then periodic polling. */
+int WifiStateMachine::messageLane(const Message *message) const
+{
+    switch (message->command()) {
+    case ASSOCIATED_WITH_EVENT: case AUTHENTICATION_FAILURE_EVENT:
+    case CTRL_EVENT_BSS_CHANGES:
+    case CTRL_EVENT_DRIVER_STATE: case CTRL_EVENT_EAP_FAILURE:
+    case CTRL_EVENT_LINK_SPEED: case CTRL_EVENT_SCAN_STARTED:
+    case CTRL_EVENT_SIGNAL_CHANGE: case KEY_COMPLETED_EVENT:
+    case NETWORK_CONNECTION_EVENT: case NETWORK_DISCONNECTION_EVENT:
+    case NETWORK_RECONNECTION_EVENT: case SUP_CONNECTION_EVENT:
+    case SUP_DISCONNECTION_EVENT: case SUP_SCAN_RESULTS_EVENT:
+    case SUP_STATE_CHANGE_EVENT: case WPS_AP_AVAILABLE_EVENT:
+        return LANE_HARDWARE;
+    case DHCP_SUCCESS: case DHCP_FAILURE:
+    case CMD_LOAD_DRIVER_SUCCESS: case CMD_LOAD_DRIVER_FAILURE:
+    case CMD_UNLOAD_DRIVER_SUCCESS: case CMD_UNLOAD_DRIVER_FAILURE:
+    case CMD_STOP_SUPPLICANT_SUCCESS: case CMD_STOP_SUPPLICANT_FAILURE:
+        return LANE_INTERNAL;
+    case CMD_RSSI_POLL: case CMD_SAVE_CONFIG:
+        return LANE_HOUSEKEEPING;
+    }
+    return LANE_CLIENT;
+}
+
+/* Client toggles only need their latest value, any number of scan
+   requests queued together are satisfied by a single scan, and only the
+   latest signal report matters. */
+int WifiStateMachine::coalesceMode(int command) const
+{
+    switch (command) {
+    case CMD_START_SCAN:
+    case CMD_ENABLE_RSSI_POLL:
+    case CMD_ENABLE_BACKGROUND_SCAN:
+    case CTRL_EVENT_SIGNAL_CHANGE:
+        return COALESCE_REPLACE;
+    }
+    return COALESCE_NONE;
+}
+
+void WifiStateMachine::coalesceArgs(int command, int *arg1, int *arg2, const Message *incoming) const
+{
+    if (command == CMD_START_SCAN) {
+        // Scan actively if any of the merged requests asked for it
+        *arg1 = (*arg1 > 0 || incoming->arg1() > 0) ? 1 : 0;
+        return;
+    }
+    StateMachine::coalesceArgs(command, arg1, arg2, incoming);
 }
 
 void WifiStateMachine::enqueue_network_update(const ConfiguredStation& cs)
@@ -699,10 +1279,16 @@ void WifiStateMachine::enqueue_network_update(const ConfiguredStation& cs)
     enqueue(new AddOrUpdateNetworkMessage(cs));
 }
 
+void WifiStateMachine::enqueue_network_batch(const Vector<ConfiguredStation>& updates,
+                                             const Vector<int>& removals)
+{
+    enqueue(new NetworkBatchMessage(updates, removals));
+}
+
 void WifiStateMachine::flushDnsCache() 
 {
-    ncommand("resolver flushif %s", mInterface.string());
-    ncommand("resolver flushdefaultif");
+    mNetd.post(netdReply, NULL, "resolver flushif %s", mInterface.string());
+    mNetd.post(netdReply, NULL, "resolver flushdefaultif");
 }
 
 // ------------------------------------------------------------
@@ -717,6 +1303,7 @@ stateprocess_t WifiStateMachine::process_action(int state, Message *message)
     switch (state) {
     case SUPPLICANT_STOPPING_STATE:
         mService->BroadcastState(WS_DISABLING);
+        flushConfig();
         if (!doWifiBooleanCommand("TERMINATE"))
             request_wifi(WIFI_STOP_SUPPLICANT);
         transitionTo(DRIVER_LOADED_STATE);
@@ -763,12 +1350,15 @@ stateprocess_t WifiStateMachine::process_action(int state, Message *message)
     case STATEEV(CONNECTED_STATE, CMD_STOP_SUPPLICANT):
     case STATEEV(DISCONNECTED_STATE, CMD_STOP_SUPPLICANT):
     case STATEEV(DRIVER_STOPPING_STATE, CMD_STOP_SUPPLICANT):
+        flushConfig();
+        /* fall through */
     case STATEEV(DISCONNECTING_STATE, SUP_STATE_CHANGE_EVENT):
         disable_interface();
         break;
     case STATEEV(DRIVER_STARTED_STATE, CMD_START_SCAN):
     case STATEEV(SCAN_MODE_STATE, CMD_START_SCAN):
-        start_scan(message->arg1() != 0);
+        if (!attachToPendingScan())
+            start_scan(message->arg1() != 0);
         /* fall through */
     case STATEEV(SUPPLICANT_STARTING_STATE, SUP_STATE_CHANGE_EVENT):
     case STATEEV(CONNECTING_STATE, SUP_STATE_CHANGE_EVENT):
@@ -801,13 +1391,19 @@ stateprocess_t WifiStateMachine::process_action(int state, Message *message)
         doWifiBooleanCommand("AP_SCAN 1");  // CONNECT_MODE
         return SM_HANDLED;
     case STATEEV(CONNECTED_STATE, CMD_START_SCAN):
+        if (attachToPendingScan())
+            return SM_HANDLED;
         doWifiBooleanCommand("AP_SCAN 2");   // SCAN_ONLY_MODE
-        /* fall through */
+        start_scan(message->arg1() != 0);
+        return SM_HANDLED;
     case STATEEV(CONNECTING_STATE, CMD_START_SCAN):
     case STATEEV(DISCONNECTING_STATE, CMD_START_SCAN):
-        start_scan(message->arg1() != 0);
+        if (!attachToPendingScan())
+            start_scan(message->arg1() != 0);
         return SM_HANDLED;
     case STATEEV(DISCONNECTED_STATE, CMD_START_SCAN):
+        if (attachToPendingScan())
+            return SM_HANDLED;
         /* Disable background scan temporarily during a regular scan */
         if (mEnableBackgroundScan)
             doWifiBooleanCommand("DRIVER BGSCAN-STOP");
@@ -829,46 +1425,45 @@ stateprocess_t WifiStateMachine::invoke_process(int state, Message *message)
     int network_id = message->arg1();
 
     SLOGV("....Start processing message %s (%d) in state %s\n", msgStr(message->command()),
-        message->command(), state_table[state].name);
+        message->command(), sWifiStates.stateName(state));
     switch (message->command()) {
     case AUTHENTICATION_FAILURE_EVENT:
         SLOGV("TODO: Authentication failure\n");
         return SM_HANDLED;
     case CMD_LOAD_DRIVER:
         mService->BroadcastState(WS_ENABLING);
-        if (request_wifi(WIFI_LOAD_DRIVER))
-            mService->BroadcastState(WS_UNKNOWN);
+        submit(loadDriverJob, this);
+        break;
+    case CMD_LOAD_DRIVER_FAILURE:
+    case CMD_UNLOAD_DRIVER_FAILURE:
+        mService->BroadcastState(WS_UNKNOWN);
         break;
     case CMD_UNLOAD_DRIVER:
-        mService->BroadcastState(request_wifi(WIFI_UNLOAD_DRIVER) ? WS_UNKNOWN : WS_DISABLED);
+        flushConfig();
+        submit(unloadDriverJob, this);
+        break;
+    case CMD_UNLOAD_DRIVER_SUCCESS:
+        mService->BroadcastState(WS_DISABLED);
         break;
     case CMD_ENABLE_RSSI_POLL:
         mEnableRssiPolling = message->arg1() != 0;
+        if (!mEnableRssiPolling)
+            removeDelayed(CMD_RSSI_POLL);
         /* fall through */
     case CMD_RSSI_POLL:
-        if (mEnableRssiPolling) {
+        if (rssiPollActive()) {
             String8 poll = doWifiStringCommand("SIGNAL_POLL");
-            Vector<String8> elements = splitString(poll, '\n');
+            KeyValueIterator elements(poll, '\n');
+            StringSpan key, value;
             int rssi = -1;
             int link_speed = -1;
-            for (size_t i = 0 ; i < elements.size() ; i++) {
-                Vector<String8> pair = splitString(elements[i], '=');
-                if (pair.size() == 2) {
-                    if (pair[0] == "RSSI")
-                        rssi = atoi(pair[1].string());
-                    else if (pair[0] == "LINKSPEED")
-                        link_speed = atoi(pair[1].string());
-                }
-            }
-            Mutex::Autolock _l(mReadLock);
-            mWifiInformation.rssi = rssi != -1 ? rssi : -9999;
-            mService->BroadcastRssi(mWifiInformation.rssi);
-            if (link_speed != -1) {
-                mWifiInformation.link_speed = link_speed;
-                mService->BroadcastLinkSpeed(link_speed);
+            while ((rssi == -1 || link_speed == -1) && elements.next(&key, &value)) {
+                if (key.equals("RSSI"))
+                    rssi = value.toInt();
+                else if (key.equals("LINKSPEED"))
+                    link_speed = value.toInt();
             }
-            mService->BroadcastInformation(mWifiInformation);
-            enqueueDelayed(CMD_RSSI_POLL, RSSI_POLL_INTERVAL_MSECS);
+            updateSignal(rssi != -1 ? rssi : -9999, link_speed, false);
         }
         return SM_HANDLED;
     case CMD_ENABLE_BACKGROUND_SCAN:
@@ -886,96 +1481,150 @@ stateprocess_t WifiStateMachine::invoke_process(int state, Message *message)
     case CMD_REASSOCIATE:
         doWifiBooleanCommand("REASSOCIATE");
         return SM_HANDLED;
-    case NETWORK_CONNECTION_EVENT:
-        request_wifi(DHCP_DO_REQUEST);
-        {
-        Mutex::Autolock _l(mReadLock);
+    case NETWORK_CONNECTION_EVENT: {
+        submit(dhcpJob, this, ++mDhcpGeneration);
+        mConnectTime = systemTime();
+        mSignalMonitor.reset();
         mWifiInformation.bssid = message->string();
         mWifiInformation.network_id = message->arg1();
         String8 status = doWifiStringCommand("STATUS");
         SLOGV("....checking status '%s'\n", status.string());
-        Vector<String8> lines = splitString(status, '\n');
-        for (size_t i=0 ; i < lines.size() ; i++) {
-            Vector<String8> pair = splitString(lines[i], '=');
-            if (pair.size() == 2 && pair[0] == "ssid")
-                mWifiInformation.ssid = pair[1];
+        KeyValueIterator lines(status, '\n');
+        StringSpan key, value;
+        while (lines.next(&key, &value)) {
+            if (key.equals("ssid"))
+                mWifiInformation.ssid = value.toString8();
         }
-        mService->BroadcastInformation(mWifiInformation);
-        for (size_t i = 0 ; i < mStationsConfig.size() ; i++) {
-            ConfiguredStation& cs = mStationsConfig.editItemAt(i);
-            if (cs.network_id == mWifiInformation.network_id) {
-                if (cs.status == ConfiguredStation::ENABLED)
-                    cs.status = ConfiguredStation::CURRENT;
-                else
-                    SLOGI("......networkConnect to disabled station\n");
-                break;
-            }
+        publishInformation();
+        ssize_t index = mStationsConfig.indexOfNetworkId(mWifiInformation.network_id);
+        if (index >= 0) {
+            ConfiguredStation& cs = mStationsConfig.editItemAt(index);
+            if (cs.status == ConfiguredStation::ENABLED)
+                cs.status = ConfiguredStation::CURRENT;
+            else
+                SLOGI("......networkConnect to disabled station\n");
         }
-        mService->BroadcastConfiguredStations(mStationsConfig);
+        publishStations();
+        // Reconnecting to a known access point: use the previous lease
+        // while dhcpcd renews it
+        const DhcpLease *cached = mLeaseCache.find(mWifiInformation.ssid, mWifiInformation.bssid,
+                                                   DHCP_LEASE_MARGIN_SECS);
+        if (cached) {
+            SLOGV("......Using cached lease %s\n", cached->ipaddr.string());
+            mProvisionalLease = *cached;
+            mProvisionalIp = true;
+            configureIp(mProvisionalLease, true, true);
+        }
+        break;
+        }
+    case DHCP_FAILURE:
+        if (message->arg1() != mDhcpGeneration) {
+            SLOGV("......Ignoring stale DHCP failure\n");
+            return SM_HANDLED;
+        }
+        if (mProvisionalIp) {
+            // The cached lease was not renewed; stop using it
+            SLOGW("......Cached lease %s refused\n", mProvisionalLease.ipaddr.string());
+            mProvisionalIp = false;
+            mLeaseCache.remove(mProvisionalLease.bssid);
+            removeProvisionalRoute();
+            mNetd.post(netdReply, NULL, "interface clearaddrs %s", mInterface.string());
+            mWifiInformation.ipaddr = "";
+            publishInformation();
         }
         break;
     case DHCP_SUCCESS: {
         const DhcpResultMessage *dmessage = static_cast<DhcpResultMessage *>(message);
-        SLOGV("Got DHCP ipaddr=%s gateway=%s dns1=%s dns2=%s server=%s\n",
-            dmessage->ipaddr.string(), dmessage->gateway.string(), dmessage->dns1.string(),
-            dmessage->dns2.string(), dmessage->server.string());
-        // Set a default route
-        ncommand("interface route add %s default 0.0.0.0 0 %s", mInterface.string(), dmessage->gateway.string());
-        // Update property system with DNS data for the resolver
-        if (fixDnsEntry("net.dns1", dmessage->dns1.string())
-         || fixDnsEntry("net.dns2", dmessage->dns2.string())) {
-            // ### TODO: Check to make sure they aren't local addresses
-            const char *dns1 = dmessage->dns1.string();
-            const char *dns2 = dmessage->dns2.string();
-            if (!strcmp(dns1, "127.0.0.1"))
-                dns1 = "";
-            if (!strcmp(dns2, "127.0.0.1"))
-                dns2 = "";
-#if (SHORT_PLATFORM_VERSION == 43)
-            ncommand("resolver setifdns %s %s %s %s", mInterface.string(), "", dns1, dns2);
-#else
-            ncommand("resolver setifdns %s %s %s", mInterface.string(), dns1, dns2);
-#endif
-            ncommand("resolver setifdns %s", mInterface.string());
+        if (dmessage->arg1() != mDhcpGeneration) {
+            SLOGV("......Ignoring stale DHCP result %s\n", dmessage->ipaddr.string());
+            return SM_HANDLED;
         }
+        SLOGV("Got DHCP ipaddr=%s gateway=%s dns1=%s dns2=%s server=%s lease=%d\n",
+            dmessage->ipaddr.string(), dmessage->gateway.string(), dmessage->dns1.string(),
+            dmessage->dns2.string(), dmessage->server.string(), dmessage->lease);
+        DhcpLease lease;
+        lease.ssid = mWifiInformation.ssid;
+        lease.bssid = mWifiInformation.bssid;
         {
         Mutex::Autolock _l(mReadLock);
-        mWifiInformation.ipaddr = dmessage->ipaddr;
-        mService->BroadcastInformation(mWifiInformation);
+        mConnectToLease.add(mConnectTime);
+        }
+        lease.ipaddr = dmessage->ipaddr;
+        lease.gateway = dmessage->gateway;
+        lease.dns1 = dmessage->dns1;
+        lease.dns2 = dmessage->dns2;
+        lease.server = dmessage->server;
+        lease.prefixLength = dmessage->prefixLength;
+        lease.expires = time(NULL) + dmessage->lease;
+        if (mProvisionalIp && lease.ipaddr == mProvisionalLease.ipaddr
+         && lease.gateway == mProvisionalLease.gateway) {
+            // Confirmed what we have been using since the connect
+            SLOGV("......Cached lease %s confirmed\n", lease.ipaddr.string());
+            setDnsServers(lease.dns1.string(), lease.dns2.string());
+        } else {
+            // A new gateway replaces the cached one's route, not joins it
+            if (mProvisionalIp && lease.gateway != mProvisionalLease.gateway)
+                removeProvisionalRoute();
+            configureIp(lease, mProvisionalIp, false);
         }
-        if (mEnableRssiPolling)
-            enqueueDelayed(CMD_RSSI_POLL, RSSI_POLL_INTERVAL_MSECS);
+        mProvisionalIp = false;
+        if (dmessage->lease > DHCP_LEASE_MARGIN_SECS && !lease.bssid.isEmpty())
+            mLeaseCache.update(lease);
         break;
         }
+    case CTRL_EVENT_BSS_CHANGES: {
+        const BssChangesMessage *changes = static_cast<const BssChangesMessage *>(message);
+        for (size_t i = 0 ; i < changes->removed.size() ; i++)
+            mBssTable.remove(changes->removed[i]);
+        mAddedBss.appendVector(changes->added);
+        return SM_HANDLED;
+        }
+    case CTRL_EVENT_SCAN_STARTED:
+        // A scan we did not ask for (or ours); later requests can share it
+        if (!mScanResultIsPending && !mSupplicantScanning) {
+            mSupplicantScanning = true;
+            mScanStartTime = systemTime();
+        }
+        return SM_HANDLED;
+    case CTRL_EVENT_SIGNAL_CHANGE:
+        updateSignal(message->arg1(), message->arg2(), true);
+        return SM_HANDLED;
     case SUP_CONNECTION_EVENT: {
         bool something_changed = false;
+        // A new supplicant starts with an empty BSS table
+        mBssTable.clear();
+        mAddedBss.clear();
+        mBssReconcileTime = 0;
+        openMonitor();
         mService->BroadcastState(WS_ENABLED);
         // Returns data = 'Macaddr = XX:XX:XX:XX:XX:XX'
         String8 data = doWifiStringCommand("DRIVER MACADDR");
         if (strncmp("Macaddr = ", data.string(), 10))
             SLOGW("Unable to retrieve MAC address in wireless driver\n");
         else {
-            Mutex::Autolock _l(mReadLock);
             mWifiInformation.macaddr = String8(data.string() + 10);
-            mService->BroadcastInformation(mWifiInformation);
+            publishInformation();
         }
         {
-        Mutex::Autolock _l(mReadLock);
-        // ### TODO: This can stall.  Not a good idea
+        // A save still pending for a previous supplicant was lost with it
+        removeDelayed(CMD_SAVE_CONFIG);
+        mSavePending = false;
         mStationsConfig.clear();
-        String8 listStr = doWifiStringCommand("LIST_NETWORKS");
-        Vector<String8> lines = splitString(listStr, '\n');
-        // The first line is a header
-        for (size_t i = 1 ; i < lines.size() ; i++) {
-            Vector<String8> result = splitString(lines[i], '\t');
+        String8 listStr = listNetworks();
+        /* network id / ssid / bssid / flags
+           0	home	any	[CURRENT] */
+        StringTokenizer lines(listStr, '\n');
+        StringSpan line;
+        while (lines.next(&line)) {
+            StringSpan result[4];
+            size_t count = splitFields(line, '\t', result, 4);
             ConfiguredStation cs;
-            cs.network_id = atoi(result[0].string());
-            readNetworkVariables(cs);
+            cs.network_id = line.toInt();
             cs.status = ConfiguredStation::ENABLED;
-            if (result.size() > 3) {
-                if (!strcmp(result[3].string(), "[CURRENT]"))
+            if (count > 3) {
+                if (result[3].equals("[CURRENT]"))
                     cs.status = ConfiguredStation::CURRENT;
-                else if (!strcmp(result[3].string(), "[DISABLED]")) {
+                else if (result[3].equals("[DISABLED]")) {
                     cs.status = ConfiguredStation::DISABLED;
                     if (doWifiBooleanCommand("ENABLE_NETWORK %d", cs.network_id)) {
                         something_changed = true;
@@ -983,14 +1632,20 @@ stateprocess_t WifiStateMachine::invoke_process(int state, Message *message)
                     }
                 }
             }
-            mStationsConfig.push(cs);
+            mStationsConfig.add(cs);
         }
+        if (mStationsConfig.size()) {
+            // Drop the stations whose variables could not be read
+            size_t read = readNetworkVariables(mStationsConfig.editArray(), mStationsConfig.size());
+            Vector<int> unread;
+            for (size_t i = read ; i < mStationsConfig.size() ; i++)
+                unread.push(mStationsConfig[i].network_id);
+            mStationsConfig.removeNetworks(unread);     // Reindexes, now with the SSIDs
         }
-        if (something_changed) {
-            doWifiBooleanCommand("AP_SCAN 1");
-            doWifiBooleanCommand("SAVE_CONFIG");
         }
-        mService->BroadcastConfiguredStations(mStationsConfig);
+        if (something_changed)
+            saveConfigLater();
+        publishStations();
         mSupplicantRestartCount = 0;
         // Set country code if available
         // setFrequencyBand();
@@ -1001,46 +1656,23 @@ stateprocess_t WifiStateMachine::invoke_process(int state, Message *message)
         break;
         }
     case SUP_SCAN_RESULTS_EVENT: {
-        Mutex::Autolock _l(mReadLock);
         mScanResultIsPending = false;
-        /* bssid / frequency / signal level / flags / ssid
-           00:19:e3:33:55:2e2457-64[WPA-PSK-TKIP][WPA2-PSK-TKIP+CCMP][ESS]ADTC
-           00:24:d2:92:7e:e42412-65[WEP][ESS]5YPKM
-           00:26:62:50:7e:4a2462-89[WEP][ESS]HD253 */
-        String8 data = doWifiStringCommand("SCAN_RESULTS");
-        Vector<ScannedStation>     mStations;
-        mStations.clear();
-        Vector<String8> lines = splitString(data.string(), '\n');
-        for (size_t i = 1 ; i < lines.size() ; i++) {
-            Vector<String8> elements = splitString(lines[i], '\t');
-            if (elements.size() < 3 || elements.size() > 5)
-                SLOGW("......handleScanResults() Illegal data: %s\n", lines[i].string());
-            else {
-                int frequency = atoi(elements[1].string());
-                int rssi      = atoi(elements[2].string());
-                String8 flags, ssid;
-                if (elements.size() == 5) {
-                    flags = elements[3];
-                    ssid = elements[4];
-                }
-                else if (elements.size() == 4) {
-                    if (elements[3].string()[0] == '[')
-                        flags = elements[3];
-                    else
-                        ssid = elements[3];
-                }
-                ssid = trimString(ssid);
+        mSupplicantScanning = false;
+        updateBssTable();
+        Vector<ScannedStation> stations;
+        stations.setCapacity(mBssTable.size());
+        for (size_t i = 0 ; i < mBssTable.size() ; i++) {
+            const BssTable::Entry& bss = mBssTable.entryAt(i);
 #if (SHORT_PLATFORM_VERSION != 23)
-                if (!ssid.isEmpty())
+            if (bss.ssid.isEmpty())
+                continue;
 #endif
-                    mStations.push(ScannedStation(elements[0], ssid, flags, frequency, rssi));
-            }
+            stations.push(ScannedStation(bss.bssid, bss.ssid, bss.flags, bss.frequency, bss.level));
         }
-        mService->BroadcastScanResults(mStations);
+        mService->BroadcastScanResults(stations);
         break;
         }
     case CMD_ADD_OR_UPDATE_NETWORK: {
-        Mutex::Autolock _l(mReadLock);
         /* It's an update if the station has a valid network_id and
           the SSID values match.
           It's a new station if the network_id = -1 AND the SSID value
@@ -1055,12 +1687,10 @@ stateprocess_t WifiStateMachine::invoke_process(int state, Message *message)
             if (index < 0)
                 break;
         } else {   // Adding a new station
-            for (size_t i = 0 ; i < mStationsConfig.size() ; i++) {
-                if (mStationsConfig[i].ssid == cs.ssid) {
-                    SLOGW("......addOrUpdate: Attempting to add ssid=%s"
-                    " but that station already exists\n", cs.ssid.string());
-                    goto caseover;
-                }
+            if (mStationsConfig.indexOfSsid(cs.ssid) >= 0) {
+                SLOGW("......addOrUpdate: Attempting to add ssid=%s"
+                " but that station already exists\n", cs.ssid.string());
+                goto caseover;
             }
             String8 s = doWifiStringCommand("ADD_NETWORK");
             if (
@@ -1094,36 +1724,36 @@ stateprocess_t WifiStateMachine::invoke_process(int state, Message *message)
             doWifiBooleanCommand("REMOVE_NETWORK %d", network_id);
             break;
         }
-        // Save the configuration
-        doWifiBooleanCommand("AP_SCAN 1");
-        doWifiBooleanCommand("SAVE_CONFIG");
+        // Save the configuration once the changes stop coming
+        saveConfigLater();
         // We need to re-read the configuration back from the supplicant
         // to correctly update the values that will be displayed to the client.
-        if (index == -1) {
-            mStationsConfig.push(ConfiguredStation());
-            index = mStationsConfig.size() - 1;
-        }
-        ConfiguredStation& station(mStationsConfig.editItemAt(index));
+        ConfiguredStation station;
+        if (index != -1)
+            station = mStationsConfig[index];
         station.network_id = network_id;
         if (cs.network_id == -1)
             station.status = ConfiguredStation::DISABLED;
-        readNetworkVariables(station);
+        if (readNetworkVariables(station)) {
+            if (index == -1)
+                mStationsConfig.add(station);
+            else
+                mStationsConfig.replaceAt(index, station);
+        } else if (index == -1) {
+            setRequestedVariables(station, cs);
+            mStationsConfig.add(station);
+        }
         }
         /* fall through */
     case CMD_SELECT_NETWORK: {
         /* Fix this network to have the highest priority and disable all others.
            For the moment we'll not worry about too high of a priority */
-        Mutex::Autolock _l(mReadLock);
         if (network_id == -1)
             break;
         int index = findIndexByNetworkId(network_id);
         if (index < 0)
             break;
-        int p = 0;
-        for (size_t i = 0 ; i < mStationsConfig.size() ; i++) {
-            if (mStationsConfig[i].priority > p)
-                p = mStationsConfig[i].priority;
-        }
+        int p = mStationsConfig.maxPriority();
         if (mStationsConfig[index].priority < p) {
             p++;
             if (!doWifiBooleanCommand("SET_NETWORK %d priority %d", network_id, p))
@@ -1136,6 +1766,14 @@ stateprocess_t WifiStateMachine::invoke_process(int state, Message *message)
         setStatus((message->command() != CMD_ENABLE_NETWORK || message->arg2() != 0)
              ? "SELECT_NETWORK %d" : "ENABLE_NETWORK %d", network_id, ConfiguredStation::ENABLED);
         return SM_HANDLED;
+    case CMD_SAVE_CONFIG:
+        flushConfig();
+        return SM_HANDLED;
+    case CMD_UPDATE_NETWORKS: {
+        NetworkBatchMessage *batch = static_cast<NetworkBatchMessage *>(message);
+        updateNetworks(batch->mUpdates, batch->mRemovals);
+        }
+        return SM_HANDLED;
     case CMD_DISABLE_NETWORK:
         setStatus("DISABLE_NETWORK %d", network_id, ConfiguredStation::DISABLED);
         return SM_HANDLED;
@@ -1148,43 +1786,32 @@ stateprocess_t WifiStateMachine::invoke_process(int state, Message *message)
         }
         return SM_HANDLED;
     case CMD_START_SUPPLICANT:
-        ncommand("softap fwreload %s STA", mInterface.string());
+        // The reload overlaps with reading the interface configuration
+        mNetd.post(netdReply, NULL, "softap fwreload %s STA", mInterface.string());
         setInterfaceState(0);
-        if (request_wifi(WIFI_START_SUPPLICANT)) {
-            transitionTo(DRIVER_UNLOADING_STATE);
-            break;
-        }
-        androidCreateThread(monitorThread, this);
+        submit(startSupplicantJob, this);
         break;
     }
 caseover:;
     if (result == SM_NOT_HANDLED)
         result = process_action(state, message);
     if (result == SM_DEFAULT) {
-        STATE_TRANSITION *t = state_table[state].tran;
+        int target = sWifiStates.target(state, message->command());
         result = SM_NOT_HANDLED;
-        while (t && t->state) {
-            if (t->event == message->command()) {
-                result = SM_DEFER;
-                if (t->state != DEFER_STATE) {
-                    SLOGV("......Transition to %s\n", state_table[t->state].name);
-                    transitionTo(t->state);
-                    result = SM_HANDLED;
-                }
-                break;
-            }
-            t++;
+        if (target == DEFER_STATE)
+            result = SM_DEFER;
+        else if (target) {
+            SLOGV("......Transition to %s\n", sWifiStates.stateName(target));
+            transitionTo(target);
+            result = SM_HANDLED;
         }
     }
     if (result == SM_NOT_HANDLED) {
-        STATE_TRANSITION *t = state_table[DEFAULT_STATE].tran;
-        while (t && t->state) {
-            if (t->event == message->command()) {
-                SLOGV("......DEFAULT transition to %s\n", state_table[t->state].name);
-                transitionTo(t->state);
-                return SM_HANDLED;
-            }
-            t++;
+        int target = sWifiStates.target(DEFAULT_STATE, message->command());
+        if (target) {
+            SLOGV("......DEFAULT transition to %s\n", sWifiStates.stateName(target));
+            transitionTo(target);
+            return SM_HANDLED;
         }
         switch (message->command()) {
         case SUP_SCAN_RESULTS_EVENT:
@@ -10,6 +10,13 @@
 
 #include <wifi/IWifiClient.h>
 #include "StateMachine.h"
+#include "SupplicantChannel.h"
+#include "NetdClient.h"
+#include "DhcpLeaseCache.h"
+#include "SignalMonitor.h"
+#include "StationStore.h"
+#include "Snapshot.h"
+#include "BssTable.h"
 #if defined(SHORT_PLATFORM_VERSION) && (SHORT_PLATFORM_VERSION <= 40)
 /* Not used before 4.1 */
 #define WIFI_DEVICE_ID
@@ -17,6 +24,8 @@
 #define WIFI_DEVICE_ID 0
 #endif
 
+struct wpa_ctrl;
+
 namespace android {
 class WifiService;
 class WifiStateMachine : public StateMachine 
@@ -26,15 +35,24 @@ public:
     stateprocess_t invoke_process(int, Message *);
 
     void           enqueue_network_update(const ConfiguredStation& cs);
-    /* The WifiMonitor watches for supplicant messages about wifi
-     state and posts them to the state machine.  It runs in its own thread */
+    void           enqueue_network_batch(const Vector<ConfiguredStation>& updates,
+                                         const Vector<int>& removals);
     void           Register(const sp<IWifiClient>& client, int flags);
     int            request_wifi(int request);
-    bool           process_indication(void);
+    Message       *dhcp_request(int generation);
+    // Connect to IP address timings, for "dumpsys wifi"
+    void           dumpConnectTimes(String8& out);
+    struct ConnectTiming {
+        ConnectTiming() : count(0), totalMsecs(0), minMsecs(0), maxMsecs(0), lastMsecs(0) {}
+        void    add(nsecs_t start);
+        int     count;
+        int64_t totalMsecs;
+        int     minMsecs, maxMsecs, lastMsecs;
+    };
     enum { WIFI_LOAD_DRIVER = 1, WIFI_UNLOAD_DRIVER, WIFI_IS_DRIVER_LOADED,
         WIFI_START_SUPPLICANT, WIFI_STOP_SUPPLICANT,
         WIFI_CONNECT_SUPPLICANT, WIFI_CLOSE_SUPPLICANT, WIFI_WAIT_EVENT,
-        DHCP_STOP, DHCP_DO_REQUEST};
+        DHCP_STOP};
 
 protected:
     int            findIndexByNetworkId(int network_id);
@@ -43,42 +61,82 @@ protected:
     String8        doWifiStringCommand(const char *fmt, va_list args);
     String8        doWifiStringCommand(const char *fmt, ...);
     bool           doWifiBooleanCommand(const char *fmt, ...);
-    void           readNetworkVariables(ConfiguredStation& station);
+    size_t         exchangeCommands(const Vector<String8>& commands, Vector<String8>& replies);
+    bool           readNetworkVariables(ConfiguredStation& station);
+    size_t         readNetworkVariables(ConfiguredStation *stations, size_t count);
+    void           updateBssTable(void);
+    String8        listNetworks(void);
+    void           configureIp(const DhcpLease& lease, bool setAddress, bool cached);
+    void           removeProvisionalRoute(void);
+    void           setDnsServers(const char *dns1, const char *dns2);
+    void           updateSignal(int rssi, int link_speed, bool fromEvent);
+    bool           rssiPollActive() const;
+    void           scheduleRssiPoll(int interval);
+    void           saveConfigLater();
+    void           flushConfig();
     void           setStatus(const char *command, int network_id, ConfiguredStation::Status astatus);
+    void           enableDisabledNetworks();
+    void           updateNetworks(const Vector<ConfiguredStation>& updates, const Vector<int>& removals);
+    bool           attachToPendingScan();
     void           start_scan(bool aactive);
     virtual const char *msgStr(int msg_id);
+    virtual const char *stateStr(int state);
+    virtual int messageLane(const Message *message) const;
+    virtual int coalesceMode(int command) const;
+    virtual void coalesceArgs(int command, int *arg1, int *arg2, const Message *incoming) const;
 
     String8        mInterface;
     bool           mEnableRssiPolling;
     bool           mEnableBackgroundScan;
     bool           mScanResultIsPending;
+    bool           mSupplicantScanning; // Saw SCAN-STARTED for a scan we did not request
+    nsecs_t        mScanStartTime;
+    int            mDhcpGeneration;    // Identifies the current DHCP request
+    BssTable       mBssTable;
+    Vector<int>    mAddedBss;          // Supplicant ids added since the last scan
+    nsecs_t        mBssReconcileTime;  // Last full read of the BSS table
+    DhcpLeaseCache mLeaseCache;
+    bool           mProvisionalIp;     // Using a cached lease until DHCP confirms it
+    DhcpLease      mProvisionalLease;
+    nsecs_t        mConnectTime;       // Of the current connection
+    ConnectTiming  mConnectToIp[2];    // Full DHCP, cached lease; guarded by mReadLock
+    ConnectTiming  mConnectToLease;    // Until DHCP completes; guarded by mReadLock
+    SignalMonitor  mSignalMonitor;
+    int            mInformationRssi;   // rssi in the last Information broadcast
     int            mSupplicantRestartCount;
+    bool           mSavePending;       // SAVE_CONFIG is waiting for CMD_SAVE_CONFIG
+    nsecs_t        mSaveDeadline;      // The pending save is not put off past this
     WifiService    *mService;
 
-    // These elements can be accessed by an outside thread
-    // so they must all be read-protected
+    // The connect timings are read by "dumpsys wifi" on a binder thread
     mutable Mutex              mReadLock; 
+    // Only the state machine thread touches these; other threads read
+    // the copies last published with publishInformation()/publishStations()
     WifiInformation            mWifiInformation;   // Information about the current network
-    // TODO:  Probably need a Mutex lock
-    Vector<ConfiguredStation>  mStationsConfig;
+    StationStore               mStationsConfig;
+    Published<WifiInformation>            mPublishedInformation;
+    Published< Vector<ConfiguredStation> > mPublishedStations;
+    void                       publishInformation();
+    void                       publishStations();
     void                       setInterfaceState(int astate);
     void                       flushDnsCache();
     String8                    ncommand(const char *fmt, ...);
     void                       disable_interface(void);
+    /* The supplicant monitor connection is serviced on the state machine
+       thread; it posts supplicant events about wifi state to the queue */
+    void                       openMonitor(void);
+    void                       supplicantPath(char *path, size_t size) const;
+    void                       closeMonitor(void);
 private:
     stateprocess_t             process_action(int state, Message *message);
-    mutable Mutex              mLock;     // Protects the response queue
-    mutable Condition          mCondition;
-    int                        mFd;
-    Vector<String8>            mResponseQueue;
-    int                        mSequenceNumber;
-    char                       indication_buf[1024];
-    int                        indication_start;
+    struct wpa_ctrl            *mMonitor;
+    SupplicantChannel          mCommands;   // Opened along with mMonitor
+    Vector<char>               mEventBuffer; // Reused by every monitor read
+    NetdClient                 mNetd;
 };
 
 };  // namespace android
 
-#define FSM_DEFINE_ENUMS
 #include "wifistates.h"
 
 #endif // _WIFI_STATE_MACHINE_H
@@ -1,6 +1,10 @@
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
 #include <cutils/properties.h>
+#include <binder/IPCThreadState.h>
+#include <binder/IServiceManager.h>
 #include "WifiService.h"
 #include "WifiStateMachine.h"
 
@@ -10,9 +14,15 @@ class WifiServerClient
 {
 public:
     WifiServerClient(const sp<android::IWifiClient>& c, WifiClientFlag f=WIFI_CLIENT_FLAG_ALL)
-	: client(c), flags(f) {}
+	: client(c), flags(f), scanGeneration(0)
+	, rssiHysteresis(0), sentRssi(NO_SIGNAL), sentLinkSpeed(-1) {}
+    enum { NO_SIGNAL = -9999 };
     sp<android::IWifiClient> client;
     WifiClientFlag           flags;
+    int                      scanGeneration;  // Last scan list sent, 0 for none
+    int                      rssiHysteresis;  // dBm
+    int                      sentRssi;        // Last values sent
+    int                      sentLinkSpeed;
 };
 
 // ---------------------------------------------------------------------------
@@ -40,6 +50,7 @@ WifiService::WifiService()
     char *flags = ::getenv("DEBUG_WIFI");
 
     mState = WS_DISABLED;
+    mScanGeneration = 0;
     mWifiStateMachine = new WifiStateMachine("wlan0", this);
     property_get(enable_key, value, "false");
     SetEnabled((strcasecmp(value, "true") == 0));
@@ -52,6 +63,23 @@ void WifiService::binderDied(const wp<IBinder>& who)
     // printf(".......BINDER CLIENT DIED...removing client from %p (%d left)\n", this, mClients.size());
 }
 
+status_t WifiService::dump(int fd, const Vector<String16>& args)
+{
+    String8 result;
+    if (!checkCallingPermission(String16("android.permission.DUMP"))) {
+        result.appendFormat("Permission Denial: can't dump WifiService from pid=%d, uid=%d\n",
+                            IPCThreadState::self()->getCallingPid(),
+                            IPCThreadState::self()->getCallingUid());
+    } else {
+        Mutex::Autolock _l(mLock);
+        result.appendFormat("WifiService state %d, %d clients\n", mState, (int)mClients.size());
+        mWifiStateMachine->dumpTrace(result);
+        mWifiStateMachine->dumpConnectTimes(result);
+    }
+    write(fd, result.string(), result.size());
+    return NO_ERROR;
+}
+
 // BnWifiService
 void WifiService::Register(const sp<IWifiClient>& client, WifiClientFlag flags)
 {
@@ -68,6 +96,9 @@ void WifiService::Register(const sp<IWifiClient>& client, WifiClientFlag flags)
         // printf(".....creating new WifiServerClient %p (size=%d)....\n", this, mClients.size());
     }
     client_for_wifi->flags = flags;
+    client_for_wifi->scanGeneration = 0;
+    client_for_wifi->sentRssi = WifiServerClient::NO_SIGNAL;
+    client_for_wifi->sentLinkSpeed = -1;
     SLOGV("^^^^^^^ REGISTER CLIENT %p flags=%u ^^^^^^\n", client.get(), flags);
     if (flags & WIFI_CLIENT_FLAG_STATE)
 	client->State(mState);
@@ -94,6 +125,20 @@ void WifiService::AddOrUpdateNetwork(const ConfiguredStation& cs)
     mWifiStateMachine->enqueue_network_update(cs);
 }
 
+void WifiService::AddOrUpdateNetworks(const Vector<ConfiguredStation>& stations)
+{
+    Mutex::Autolock _l(mLock);
+    if (stations.size())
+	mWifiStateMachine->enqueue_network_batch(stations, Vector<int>());
+}
+
+void WifiService::RemoveNetworks(const Vector<int>& network_ids)
+{
+    Mutex::Autolock _l(mLock);
+    if (network_ids.size())
+	mWifiStateMachine->enqueue_network_batch(Vector<ConfiguredStation>(), network_ids);
+}
+
 void WifiService::BroadcastState(WifiState state)
 {
     Mutex::Autolock _l(mLock);
@@ -108,13 +153,67 @@ void WifiService::BroadcastState(WifiState state)
     }
 }
 
+void WifiService::ResyncScanResults(const sp<IWifiClient>& client)
+{
+    Mutex::Autolock _l(mLock);
+    ssize_t index = mClients.indexOfKey(client->asBinder());
+    if (index >= 0 && (mClients.valueAt(index)->flags & WIFI_CLIENT_FLAG_SCAN_DELTAS))
+	sendScanSnapshot(mClients.valueAt(index));
+}
+
+// Called with mLock held
+void WifiService::sendScanSnapshot(WifiServerClient *client)
+{
+    Vector<ScannedStation> all;
+    Vector<String8> none;
+    all.setCapacity(mScanResults.size());
+    for (size_t i = 0 ; i < mScanResults.size() ; i++)
+	all.push(mScanResults.valueAt(i));
+    client->client->ScanResultsDelta(0, mScanGeneration, all, none);
+    client->scanGeneration = mScanGeneration;
+}
+
+static bool sameStation(const ScannedStation& a, const ScannedStation& b)
+{
+    return a.rssi == b.rssi && a.frequency == b.frequency
+	&& a.ssid == b.ssid && a.flags == b.flags;
+}
+
+/* Clients that take deltas get the changes since the last broadcast,
+   or the whole list if they have not seen the last broadcast */
 void WifiService::BroadcastScanResults(const Vector<ScannedStation>& scandata)
 {
-//    printf("^^^^^^^ BROADCAST SCAN RESULTS (%d clients) ^^^^^^\n", mClients.size());
     Mutex::Autolock _l(mLock);
+    KeyedVector<String8, ScannedStation> current;
+    Vector<ScannedStation> changed;
+    Vector<String8> removed;
+
+    for (size_t i = 0 ; i < scandata.size() ; i++) {
+	const ScannedStation& station = scandata[i];
+	current.add(station.bssid, station);
+	ssize_t index = mScanResults.indexOfKey(station.bssid);
+	if (index < 0 || !sameStation(mScanResults.valueAt(index), station))
+	    changed.push(station);
+    }
+    for (size_t i = 0 ; i < mScanResults.size() ; i++) {
+	if (current.indexOfKey(mScanResults.keyAt(i)) < 0)
+	    removed.push(mScanResults.keyAt(i));
+    }
+    mScanResults = current;
+    int base = mScanGeneration;
+    mScanGeneration = mScanGeneration + 1 > 0 ? mScanGeneration + 1 : 1;
+
     for (size_t i = 0 ; i < mClients.size() ; i++) {
 	WifiServerClient *client = mClients.valueAt(i);
-	if (client->flags & WIFI_CLIENT_FLAG_SCAN_RESULTS)
+	if (client->flags & WIFI_CLIENT_FLAG_SCAN_DELTAS) {
+	    if (client->scanGeneration != base || base == 0)
+		sendScanSnapshot(client);
+	    else {
+		client->client->ScanResultsDelta(base, mScanGeneration, changed, removed);
+		client->scanGeneration = mScanGeneration;
+	    }
+	}
+	else if (client->flags & WIFI_CLIENT_FLAG_SCAN_RESULTS)
 	    client->client->ScanResults(scandata);
     }
 }
@@ -140,13 +239,20 @@ void WifiService::BroadcastInformation(const WifiInformation& info)
     }
 }
 
+// Each client only hears about changes that leave its hysteresis band;
+// losing or regaining the signal is always sent
 void WifiService::BroadcastRssi(int rssi)
 {
     Mutex::Autolock _l(mLock);
     for (size_t i = 0 ; i < mClients.size() ; i++) {
 	WifiServerClient *client = mClients.valueAt(i);
-	if (client->flags & WIFI_CLIENT_FLAG_RSSI)
-	    client->client->Rssi(rssi);
+	if (!(client->flags & WIFI_CLIENT_FLAG_RSSI) || rssi == client->sentRssi)
+	    continue;
+	if (rssi != WifiServerClient::NO_SIGNAL && client->sentRssi != WifiServerClient::NO_SIGNAL
+	 && abs(rssi - client->sentRssi) < client->rssiHysteresis)
+	    continue;
+	client->sentRssi = rssi;
+	client->client->Rssi(rssi);
     }
 }
 
@@ -155,11 +261,21 @@ void WifiService::BroadcastLinkSpeed(int link_speed)
     Mutex::Autolock _l(mLock);
     for (size_t i = 0 ; i < mClients.size() ; i++) {
 	WifiServerClient *client = mClients.valueAt(i);
-	if (client->flags & WIFI_CLIENT_FLAG_LINK_SPEED)
+	if ((client->flags & WIFI_CLIENT_FLAG_LINK_SPEED) && link_speed != client->sentLinkSpeed) {
+	    client->sentLinkSpeed = link_speed;
 	    client->client->LinkSpeed(link_speed);
+	}
     }
 }
 
+void WifiService::SetRssiHysteresis(const sp<IWifiClient>& client, int dbm)
+{
+    Mutex::Autolock _l(mLock);
+    ssize_t index = mClients.indexOfKey(client->asBinder());
+    if (index >= 0)
+	mClients.valueAt(index)->rssiHysteresis = dbm > 0 ? dbm : 0;
+}
+
 void WifiService::SendCommand(int command, int arg1, int arg2)
 {
     Mutex::Autolock _l(mLock);
@@ -192,11 +308,37 @@ status_t BnWifiService::onTransact( uint32_t code, const Parcel& data, Parcel* r
 	int arg2    = data.readInt32();
 	SendCommand(command, arg1, arg2);
     }   return NO_ERROR;
-    case ADD_OR_UPDATE_NETWORK:
+    case ADD_OR_UPDATE_NETWORK: {
 	CHECK_INTERFACE(IWifiServer, data, reply);
 	ConfiguredStation cs(data);
 	AddOrUpdateNetwork(cs);
-	return NO_ERROR;
+    }   return NO_ERROR;
+    case RESYNC_SCAN_RESULTS: {
+	CHECK_INTERFACE(IWifiServer, data, reply);
+	sp<IWifiClient> client = interface_cast<IWifiClient>(data.readStrongBinder());
+	ResyncScanResults(client);
+    }   return NO_ERROR;
+    case SET_RSSI_HYSTERESIS: {
+	CHECK_INTERFACE(IWifiServer, data, reply);
+	sp<IWifiClient> client = interface_cast<IWifiClient>(data.readStrongBinder());
+	SetRssiHysteresis(client, data.readInt32());
+    }   return NO_ERROR;
+    case ADD_OR_UPDATE_NETWORKS: {
+	CHECK_INTERFACE(IWifiServer, data, reply);
+	Vector<ConfiguredStation> v;
+	int vlen = data.readInt32();
+	for (int i = 0 ; i < vlen && data.dataAvail() ; i++)
+	    v.push(ConfiguredStation(data));
+	AddOrUpdateNetworks(v);
+    }   return NO_ERROR;
+    case REMOVE_NETWORKS: {
+	CHECK_INTERFACE(IWifiServer, data, reply);
+	Vector<int> v;
+	int vlen = data.readInt32();
+	for (int i = 0 ; i < vlen && data.dataAvail() ; i++)
+	    v.push(data.readInt32());
+	RemoveNetworks(v);
+    }   return NO_ERROR;
     }
     return BBinder::onTransact(code, data, reply, flags);
 }
@@ -1,137 +1,207 @@
+/*
+  Wifi state machine description.
+
+  Each list is an X-macro: the caller supplies a macro X and two
+  pass-through arguments.  StateTable.h turns these lists into the
+  enums, the name tables and the dense transition table at compile time.
+
+    WIFI_FSM_EVENTS       X(a, b, EVENT)
+    WIFI_FSM_STATES       X(a, b, STATE, "Name", kind)
+    WIFI_FSM_TRANSITIONS  X(a, b, FROM_STATE, EVENT, TO_STATE)
+    WIFI_FSM_INTERNAL     X(a, b, FROM_STATE, TO_STATE)
+
+  Transitions to DEFER_STATE defer the event until the next state change.
+  DEFAULT_STATE transitions apply when the current state has none.
+  Internal transitions are taken by code (transitionTo) and only feed the
+  reachability check.
+ */
+
+#ifndef _WIFISTATES_H
+#define _WIFISTATES_H
+
+#include "StateTable.h"
+
 namespace android {
-#ifdef FSM_DEFINE_ENUMS
-enum { EVENT_NONE=1,
-    ASSOCIATED_WITH_EVENT, AUTHENTICATION_FAILURE_EVENT, CMD_ADD_OR_UPDATE_NETWORK, 
-    CMD_CONNECT_NETWORK, CMD_DISABLE_NETWORK, CMD_DISCONNECT, 
-    CMD_ENABLE_BACKGROUND_SCAN, CMD_ENABLE_NETWORK, CMD_ENABLE_RSSI_POLL, 
-    CMD_LOAD_DRIVER, CMD_LOAD_DRIVER_FAILURE, CMD_LOAD_DRIVER_SUCCESS, 
-    CMD_REASSOCIATE, CMD_RECONNECT, CMD_REMOVE_NETWORK, 
-    CMD_RSSI_POLL, CMD_SELECT_NETWORK, CMD_START_DRIVER, 
-    CMD_START_SCAN, CMD_START_SUPPLICANT, CMD_STOP_DRIVER, 
-    CMD_STOP_SUPPLICANT, CMD_STOP_SUPPLICANT_FAILURE, CMD_STOP_SUPPLICANT_SUCCESS, 
-    CMD_UNLOAD_DRIVER, CMD_UNLOAD_DRIVER_FAILURE, CMD_UNLOAD_DRIVER_SUCCESS, 
-    CTRL_EVENT_BSS_ADDED, CTRL_EVENT_BSS_REMOVED, CTRL_EVENT_DRIVER_STATE, 
-    CTRL_EVENT_EAP_FAILURE, CTRL_EVENT_LINK_SPEED, DHCP_FAILURE, 
-    DHCP_SUCCESS, KEY_COMPLETED_EVENT, NETWORK_CONNECTION_EVENT, 
-    NETWORK_DISCONNECTION_EVENT, NETWORK_RECONNECTION_EVENT, SUP_CONNECTION_EVENT, 
-    SUP_DISCONNECTION_EVENT, SUP_SCAN_RESULTS_EVENT, SUP_STATE_CHANGE_EVENT, 
-    WPS_AP_AVAILABLE_EVENT, MAX_WIFI_EVENT};
-#endif
-enum { STATE_NONE=1,
-    CONNECTED_STATE, CONNECTING_STATE, DEFER_STATE, 
-    DISCONNECTED_STATE, DISCONNECTING_STATE, DRIVER_FAILED_STATE, 
-    DRIVER_LOADED_STATE, DRIVER_LOADING_STATE, DRIVER_STARTED_STATE, 
-    DRIVER_STARTING_STATE, DRIVER_STOPPED_STATE, DRIVER_STOPPING_STATE, 
-    DRIVER_UNLOADED_STATE, DRIVER_UNLOADING_STATE, INITIAL_STATE, 
-    SCAN_MODE_STATE, SUPPLICANT_STARTING_STATE, SUPPLICANT_STOPPING_STATE, 
-    UNUSED_STATE, DEFAULT_STATE, STATE_MAX};
-extern const char *sMessageToString[MAX_WIFI_EVENT];
-#ifdef FSM_INITIALIZE_CODE
-const char *sMessageToString[MAX_WIFI_EVENT];
-STATE_TABLE_TYPE state_table[STATE_MAX];
-void initstates(void)
-{
-    static STATE_TRANSITION TRA_Connected[] = {{0,CONNECTING_STATE}, {CMD_DISCONNECT,DISCONNECTING_STATE}, {DHCP_FAILURE,DISCONNECTING_STATE}, {0,0} };
-    static STATE_TRANSITION TRA_Connecting[] = {{CMD_DISCONNECT,DISCONNECTING_STATE}, {DHCP_FAILURE,DISCONNECTING_STATE}, {DHCP_SUCCESS,CONNECTED_STATE}, {0,0} };
-    static STATE_TRANSITION TRA_Disconnected[] = {{CMD_START_SCAN,SCAN_MODE_STATE}, {0,0} };
-    static STATE_TRANSITION TRA_Disconnecting[] = {{SUP_STATE_CHANGE_EVENT,DISCONNECTED_STATE}, {0,0} };
-    static STATE_TRANSITION TRA_Driver_Loaded[] = {{CMD_START_SUPPLICANT,SUPPLICANT_STARTING_STATE}, {CMD_UNLOAD_DRIVER,DRIVER_UNLOADING_STATE}, {0,0} };
-    static STATE_TRANSITION TRA_Driver_Loading[] = {{CMD_LOAD_DRIVER,DEFER_STATE}, {CMD_LOAD_DRIVER_FAILURE,DRIVER_FAILED_STATE}, {CMD_LOAD_DRIVER_SUCCESS,DRIVER_LOADED_STATE}, {CMD_START_DRIVER,DEFER_STATE}, {CMD_START_SUPPLICANT,DEFER_STATE}, {CMD_STOP_DRIVER,DEFER_STATE}, {CMD_STOP_SUPPLICANT,DEFER_STATE}, {CMD_UNLOAD_DRIVER,DEFER_STATE}, {0,0} };
-    static STATE_TRANSITION TRA_Driver_Started[] = {{0,DISCONNECTED_STATE}, {0,SCAN_MODE_STATE}, {CMD_STOP_DRIVER,DRIVER_STOPPING_STATE}, {0,0} };
-    static STATE_TRANSITION TRA_Driver_Starting[] = {{AUTHENTICATION_FAILURE_EVENT,DEFER_STATE}, {CMD_DISCONNECT,DEFER_STATE}, {CMD_REASSOCIATE,DEFER_STATE}, {CMD_RECONNECT,DEFER_STATE}, {CMD_START_DRIVER,DEFER_STATE}, {CMD_START_SCAN,DEFER_STATE}, {CMD_STOP_DRIVER,DEFER_STATE}, {NETWORK_CONNECTION_EVENT,DEFER_STATE}, {NETWORK_DISCONNECTION_EVENT,DEFER_STATE}, {0,0} };
-    static STATE_TRANSITION TRA_Driver_Stopped[] = {{AUTHENTICATION_FAILURE_EVENT,DEFER_STATE}, {CMD_DISCONNECT,DEFER_STATE}, {CMD_REASSOCIATE,DEFER_STATE}, {CMD_RECONNECT,DEFER_STATE}, {CMD_STOP_DRIVER,DEFER_STATE}, {NETWORK_CONNECTION_EVENT,DEFER_STATE}, {NETWORK_DISCONNECTION_EVENT,DEFER_STATE}, {SUP_STATE_CHANGE_EVENT,DRIVER_STARTED_STATE}, {0,0} };
-    static STATE_TRANSITION TRA_Driver_Stopping[] = {{AUTHENTICATION_FAILURE_EVENT,DEFER_STATE}, {CMD_DISCONNECT,DEFER_STATE}, {CMD_REASSOCIATE,DEFER_STATE}, {CMD_RECONNECT,DEFER_STATE}, {CMD_START_DRIVER,DEFER_STATE}, {CMD_START_SCAN,DEFER_STATE}, {CMD_STOP_DRIVER,DEFER_STATE}, {NETWORK_CONNECTION_EVENT,DEFER_STATE}, {NETWORK_DISCONNECTION_EVENT,DEFER_STATE}, {SUP_STATE_CHANGE_EVENT,DRIVER_STOPPED_STATE}, {0,0} };
-    static STATE_TRANSITION TRA_Driver_Unloaded[] = {{CMD_LOAD_DRIVER,DRIVER_LOADING_STATE}, {0,0} };
-    static STATE_TRANSITION TRA_Driver_Unloading[] = {{CMD_LOAD_DRIVER,DEFER_STATE}, {CMD_START_DRIVER,DEFER_STATE}, {CMD_START_SUPPLICANT,DEFER_STATE}, {CMD_STOP_DRIVER,DEFER_STATE}, {CMD_STOP_SUPPLICANT,DEFER_STATE}, {CMD_UNLOAD_DRIVER,DEFER_STATE}, {CMD_UNLOAD_DRIVER_FAILURE,DRIVER_FAILED_STATE}, {CMD_UNLOAD_DRIVER_SUCCESS,DRIVER_UNLOADED_STATE}, {0,0} };
-    static STATE_TRANSITION TRA_Initial[] = {{0,DRIVER_LOADED_STATE}, {0,DRIVER_UNLOADED_STATE}, {0,0} };
-    static STATE_TRANSITION TRA_Scan_Mode[] = {{CMD_START_SCAN,DISCONNECTED_STATE}, {0,0} };
-    static STATE_TRANSITION TRA_Supplicant_Starting[] = {{CMD_LOAD_DRIVER,DEFER_STATE}, {CMD_START_DRIVER,DEFER_STATE}, {CMD_START_SUPPLICANT,DEFER_STATE}, {CMD_STOP_DRIVER,DEFER_STATE}, {CMD_STOP_SUPPLICANT,DEFER_STATE}, {CMD_UNLOAD_DRIVER,DEFER_STATE}, {SUP_CONNECTION_EVENT,DRIVER_STARTED_STATE}, {0,0} };
-    static STATE_TRANSITION TRA_Supplicant_Stopping[] = {{CMD_STOP_SUPPLICANT_FAILURE,DRIVER_LOADED_STATE}, {0,0} };
-    static STATE_TRANSITION TRA_Unused[] = {{ASSOCIATED_WITH_EVENT,DEFER_STATE}, {CMD_ADD_OR_UPDATE_NETWORK,DEFER_STATE}, {CMD_DISABLE_NETWORK,DEFER_STATE}, {CMD_ENABLE_BACKGROUND_SCAN,DEFER_STATE}, {CMD_ENABLE_NETWORK,DEFER_STATE}, {CMD_ENABLE_RSSI_POLL,DEFER_STATE}, {CMD_REMOVE_NETWORK,DEFER_STATE}, {CMD_RSSI_POLL,DEFER_STATE}, {CMD_SELECT_NETWORK,DEFER_STATE}, {CMD_STOP_SUPPLICANT_SUCCESS,DEFER_STATE}, {CTRL_EVENT_BSS_ADDED,DEFER_STATE}, {CTRL_EVENT_BSS_REMOVED,DEFER_STATE}, {CTRL_EVENT_DRIVER_STATE,DEFER_STATE}, {CTRL_EVENT_EAP_FAILURE,DEFER_STATE}, {CTRL_EVENT_LINK_SPEED,DEFER_STATE}, {KEY_COMPLETED_EVENT,DEFER_STATE}, {NETWORK_RECONNECTION_EVENT,DEFER_STATE}, {SUP_SCAN_RESULTS_EVENT,DEFER_STATE}, {WPS_AP_AVAILABLE_EVENT,DEFER_STATE}, {0,0} };
-    static STATE_TRANSITION TRA_default[] = {{CMD_CONNECT_NETWORK,DISCONNECTING_STATE}, {CMD_STOP_SUPPLICANT,SUPPLICANT_STOPPING_STATE}, {NETWORK_CONNECTION_EVENT,CONNECTING_STATE}, {NETWORK_DISCONNECTION_EVENT,DISCONNECTED_STATE}, {SUP_DISCONNECTION_EVENT,DRIVER_LOADED_STATE}, {0,0} };
 
-    state_table[CONNECTED_STATE].name = "Connected";
-    state_table[CONNECTED_STATE].tran = TRA_Connected;
-    state_table[CONNECTING_STATE].name = "Connecting";
-    state_table[CONNECTING_STATE].tran = TRA_Connecting;
-    state_table[DEFER_STATE].name = "DEFER";
-    state_table[DISCONNECTED_STATE].name = "Disconnected";
-    state_table[DISCONNECTED_STATE].tran = TRA_Disconnected;
-    state_table[DISCONNECTING_STATE].name = "Disconnecting";
-    state_table[DISCONNECTING_STATE].tran = TRA_Disconnecting;
-    state_table[DRIVER_FAILED_STATE].name = "Driver_Failed";
-    state_table[DRIVER_LOADED_STATE].name = "Driver_Loaded";
-    state_table[DRIVER_LOADED_STATE].tran = TRA_Driver_Loaded;
-    state_table[DRIVER_LOADING_STATE].name = "Driver_Loading";
-    state_table[DRIVER_LOADING_STATE].tran = TRA_Driver_Loading;
-    state_table[DRIVER_STARTED_STATE].name = "Driver_Started";
-    state_table[DRIVER_STARTED_STATE].tran = TRA_Driver_Started;
-    state_table[DRIVER_STARTING_STATE].name = "Driver_Starting";
-    state_table[DRIVER_STARTING_STATE].tran = TRA_Driver_Starting;
-    state_table[DRIVER_STOPPED_STATE].name = "Driver_Stopped";
-    state_table[DRIVER_STOPPED_STATE].tran = TRA_Driver_Stopped;
-    state_table[DRIVER_STOPPING_STATE].name = "Driver_Stopping";
-    state_table[DRIVER_STOPPING_STATE].tran = TRA_Driver_Stopping;
-    state_table[DRIVER_UNLOADED_STATE].name = "Driver_Unloaded";
-    state_table[DRIVER_UNLOADED_STATE].tran = TRA_Driver_Unloaded;
-    state_table[DRIVER_UNLOADING_STATE].name = "Driver_Unloading";
-    state_table[DRIVER_UNLOADING_STATE].tran = TRA_Driver_Unloading;
-    state_table[INITIAL_STATE].name = "Initial";
-    state_table[INITIAL_STATE].tran = TRA_Initial;
-    state_table[SCAN_MODE_STATE].name = "Scan_Mode";
-    state_table[SCAN_MODE_STATE].tran = TRA_Scan_Mode;
-    state_table[SUPPLICANT_STARTING_STATE].name = "Supplicant_Starting";
-    state_table[SUPPLICANT_STARTING_STATE].tran = TRA_Supplicant_Starting;
-    state_table[SUPPLICANT_STOPPING_STATE].name = "Supplicant_Stopping";
-    state_table[SUPPLICANT_STOPPING_STATE].tran = TRA_Supplicant_Stopping;
-    state_table[UNUSED_STATE].name = "Unused";
-    state_table[UNUSED_STATE].tran = TRA_Unused;
-    state_table[DEFAULT_STATE].name = "default";
-    state_table[DEFAULT_STATE].tran = TRA_default;
-    sMessageToString[ASSOCIATED_WITH_EVENT] = "ASSOCIATED_WITH_EVENT";
-    sMessageToString[AUTHENTICATION_FAILURE_EVENT] = "AUTHENTICATION_FAILURE_EVENT";
-    sMessageToString[CMD_ADD_OR_UPDATE_NETWORK] = "CMD_ADD_OR_UPDATE_NETWORK";
-    sMessageToString[CMD_CONNECT_NETWORK] = "CMD_CONNECT_NETWORK";
-    sMessageToString[CMD_DISABLE_NETWORK] = "CMD_DISABLE_NETWORK";
-    sMessageToString[CMD_DISCONNECT] = "CMD_DISCONNECT";
-    sMessageToString[CMD_ENABLE_BACKGROUND_SCAN] = "CMD_ENABLE_BACKGROUND_SCAN";
-    sMessageToString[CMD_ENABLE_NETWORK] = "CMD_ENABLE_NETWORK";
-    sMessageToString[CMD_ENABLE_RSSI_POLL] = "CMD_ENABLE_RSSI_POLL";
-    sMessageToString[CMD_LOAD_DRIVER] = "CMD_LOAD_DRIVER";
-    sMessageToString[CMD_LOAD_DRIVER_FAILURE] = "CMD_LOAD_DRIVER_FAILURE";
-    sMessageToString[CMD_LOAD_DRIVER_SUCCESS] = "CMD_LOAD_DRIVER_SUCCESS";
-    sMessageToString[CMD_REASSOCIATE] = "CMD_REASSOCIATE";
-    sMessageToString[CMD_RECONNECT] = "CMD_RECONNECT";
-    sMessageToString[CMD_REMOVE_NETWORK] = "CMD_REMOVE_NETWORK";
-    sMessageToString[CMD_RSSI_POLL] = "CMD_RSSI_POLL";
-    sMessageToString[CMD_SELECT_NETWORK] = "CMD_SELECT_NETWORK";
-    sMessageToString[CMD_START_DRIVER] = "CMD_START_DRIVER";
-    sMessageToString[CMD_START_SCAN] = "CMD_START_SCAN";
-    sMessageToString[CMD_START_SUPPLICANT] = "CMD_START_SUPPLICANT";
-    sMessageToString[CMD_STOP_DRIVER] = "CMD_STOP_DRIVER";
-    sMessageToString[CMD_STOP_SUPPLICANT] = "CMD_STOP_SUPPLICANT";
-    sMessageToString[CMD_STOP_SUPPLICANT_FAILURE] = "CMD_STOP_SUPPLICANT_FAILURE";
-    sMessageToString[CMD_STOP_SUPPLICANT_SUCCESS] = "CMD_STOP_SUPPLICANT_SUCCESS";
-    sMessageToString[CMD_UNLOAD_DRIVER] = "CMD_UNLOAD_DRIVER";
-    sMessageToString[CMD_UNLOAD_DRIVER_FAILURE] = "CMD_UNLOAD_DRIVER_FAILURE";
-    sMessageToString[CMD_UNLOAD_DRIVER_SUCCESS] = "CMD_UNLOAD_DRIVER_SUCCESS";
-    sMessageToString[CTRL_EVENT_BSS_ADDED] = "CTRL_EVENT_BSS_ADDED";
-    sMessageToString[CTRL_EVENT_BSS_REMOVED] = "CTRL_EVENT_BSS_REMOVED";
-    sMessageToString[CTRL_EVENT_DRIVER_STATE] = "CTRL_EVENT_DRIVER_STATE";
-    sMessageToString[CTRL_EVENT_EAP_FAILURE] = "CTRL_EVENT_EAP_FAILURE";
-    sMessageToString[CTRL_EVENT_LINK_SPEED] = "CTRL_EVENT_LINK_SPEED";
-    sMessageToString[DHCP_FAILURE] = "DHCP_FAILURE";
-    sMessageToString[DHCP_SUCCESS] = "DHCP_SUCCESS";
-    sMessageToString[KEY_COMPLETED_EVENT] = "KEY_COMPLETED_EVENT";
-    sMessageToString[NETWORK_CONNECTION_EVENT] = "NETWORK_CONNECTION_EVENT";
-    sMessageToString[NETWORK_DISCONNECTION_EVENT] = "NETWORK_DISCONNECTION_EVENT";
-    sMessageToString[NETWORK_RECONNECTION_EVENT] = "NETWORK_RECONNECTION_EVENT";
-    sMessageToString[SUP_CONNECTION_EVENT] = "SUP_CONNECTION_EVENT";
-    sMessageToString[SUP_DISCONNECTION_EVENT] = "SUP_DISCONNECTION_EVENT";
-    sMessageToString[SUP_SCAN_RESULTS_EVENT] = "SUP_SCAN_RESULTS_EVENT";
-    sMessageToString[SUP_STATE_CHANGE_EVENT] = "SUP_STATE_CHANGE_EVENT";
-    sMessageToString[WPS_AP_AVAILABLE_EVENT] = "WPS_AP_AVAILABLE_EVENT";
-}
+#define WIFI_FSM_EVENTS(X, a, b) \
+    X(a, b, ASSOCIATED_WITH_EVENT) \
+    X(a, b, AUTHENTICATION_FAILURE_EVENT) \
+    X(a, b, CMD_ADD_OR_UPDATE_NETWORK) \
+    X(a, b, CMD_CONNECT_NETWORK) \
+    X(a, b, CMD_DISABLE_NETWORK) \
+    X(a, b, CMD_DISCONNECT) \
+    X(a, b, CMD_ENABLE_BACKGROUND_SCAN) \
+    X(a, b, CMD_ENABLE_NETWORK) \
+    X(a, b, CMD_ENABLE_RSSI_POLL) \
+    X(a, b, CMD_LOAD_DRIVER) \
+    X(a, b, CMD_LOAD_DRIVER_FAILURE) \
+    X(a, b, CMD_LOAD_DRIVER_SUCCESS) \
+    X(a, b, CMD_REASSOCIATE) \
+    X(a, b, CMD_RECONNECT) \
+    X(a, b, CMD_REMOVE_NETWORK) \
+    X(a, b, CMD_RSSI_POLL) \
+    X(a, b, CMD_SAVE_CONFIG) \
+    X(a, b, CMD_SELECT_NETWORK) \
+    X(a, b, CMD_START_DRIVER) \
+    X(a, b, CMD_START_SCAN) \
+    X(a, b, CMD_START_SUPPLICANT) \
+    X(a, b, CMD_STOP_DRIVER) \
+    X(a, b, CMD_STOP_SUPPLICANT) \
+    X(a, b, CMD_STOP_SUPPLICANT_FAILURE) \
+    X(a, b, CMD_STOP_SUPPLICANT_SUCCESS) \
+    X(a, b, CMD_UPDATE_NETWORKS) \
+    X(a, b, CMD_UNLOAD_DRIVER) \
+    X(a, b, CMD_UNLOAD_DRIVER_FAILURE) \
+    X(a, b, CMD_UNLOAD_DRIVER_SUCCESS) \
+    X(a, b, CTRL_EVENT_BSS_ADDED) \
+    X(a, b, CTRL_EVENT_BSS_CHANGES) \
+    X(a, b, CTRL_EVENT_BSS_REMOVED) \
+    X(a, b, CTRL_EVENT_DRIVER_STATE) \
+    X(a, b, CTRL_EVENT_EAP_FAILURE) \
+    X(a, b, CTRL_EVENT_LINK_SPEED) \
+    X(a, b, CTRL_EVENT_SCAN_STARTED) \
+    X(a, b, CTRL_EVENT_SIGNAL_CHANGE) \
+    X(a, b, DHCP_FAILURE) \
+    X(a, b, DHCP_SUCCESS) \
+    X(a, b, KEY_COMPLETED_EVENT) \
+    X(a, b, NETWORK_CONNECTION_EVENT) \
+    X(a, b, NETWORK_DISCONNECTION_EVENT) \
+    X(a, b, NETWORK_RECONNECTION_EVENT) \
+    X(a, b, SUP_CONNECTION_EVENT) \
+    X(a, b, SUP_DISCONNECTION_EVENT) \
+    X(a, b, SUP_SCAN_RESULTS_EVENT) \
+    X(a, b, SUP_STATE_CHANGE_EVENT) \
+    X(a, b, WPS_AP_AVAILABLE_EVENT) \
+
+#define WIFI_FSM_STATES(X, a, b) \
+    X(a, b, CONNECTED_STATE, "Connected", FSM_NORMAL) \
+    X(a, b, CONNECTING_STATE, "Connecting", FSM_NORMAL) \
+    X(a, b, DEFER_STATE, "DEFER", FSM_PSEUDO) \
+    X(a, b, DISCONNECTED_STATE, "Disconnected", FSM_NORMAL) \
+    X(a, b, DISCONNECTING_STATE, "Disconnecting", FSM_NORMAL) \
+    X(a, b, DRIVER_FAILED_STATE, "Driver_Failed", FSM_NORMAL) \
+    X(a, b, DRIVER_LOADED_STATE, "Driver_Loaded", FSM_NORMAL) \
+    X(a, b, DRIVER_LOADING_STATE, "Driver_Loading", FSM_NORMAL) \
+    X(a, b, DRIVER_STARTED_STATE, "Driver_Started", FSM_NORMAL) \
+    X(a, b, DRIVER_STARTING_STATE, "Driver_Starting", FSM_SPARE) \
+    X(a, b, DRIVER_STOPPED_STATE, "Driver_Stopped", FSM_NORMAL) \
+    X(a, b, DRIVER_STOPPING_STATE, "Driver_Stopping", FSM_NORMAL) \
+    X(a, b, DRIVER_UNLOADED_STATE, "Driver_Unloaded", FSM_NORMAL) \
+    X(a, b, DRIVER_UNLOADING_STATE, "Driver_Unloading", FSM_NORMAL) \
+    X(a, b, INITIAL_STATE, "Initial", FSM_START) \
+    X(a, b, SCAN_MODE_STATE, "Scan_Mode", FSM_NORMAL) \
+    X(a, b, SUPPLICANT_STARTING_STATE, "Supplicant_Starting", FSM_NORMAL) \
+    X(a, b, SUPPLICANT_STOPPING_STATE, "Supplicant_Stopping", FSM_NORMAL) \
+    X(a, b, UNUSED_STATE, "Unused", FSM_SPARE) \
+    X(a, b, DEFAULT_STATE, "default", FSM_PSEUDO) \
+
+#define WIFI_FSM_TRANSITIONS(X, a, b) \
+    X(a, b, CONNECTED_STATE, CMD_DISCONNECT, DISCONNECTING_STATE) \
+    X(a, b, CONNECTED_STATE, DHCP_FAILURE, DISCONNECTING_STATE) \
+    X(a, b, CONNECTING_STATE, CMD_DISCONNECT, DISCONNECTING_STATE) \
+    X(a, b, CONNECTING_STATE, DHCP_FAILURE, DISCONNECTING_STATE) \
+    X(a, b, CONNECTING_STATE, DHCP_SUCCESS, CONNECTED_STATE) \
+    X(a, b, DISCONNECTED_STATE, CMD_START_SCAN, SCAN_MODE_STATE) \
+    X(a, b, DISCONNECTING_STATE, SUP_STATE_CHANGE_EVENT, DISCONNECTED_STATE) \
+    X(a, b, DRIVER_LOADED_STATE, CMD_START_SUPPLICANT, SUPPLICANT_STARTING_STATE) \
+    X(a, b, DRIVER_LOADED_STATE, CMD_UNLOAD_DRIVER, DRIVER_UNLOADING_STATE) \
+    X(a, b, DRIVER_LOADING_STATE, CMD_LOAD_DRIVER, DEFER_STATE) \
+    X(a, b, DRIVER_LOADING_STATE, CMD_LOAD_DRIVER_FAILURE, DRIVER_FAILED_STATE) \
+    X(a, b, DRIVER_LOADING_STATE, CMD_LOAD_DRIVER_SUCCESS, DRIVER_LOADED_STATE) \
+    X(a, b, DRIVER_LOADING_STATE, CMD_START_DRIVER, DEFER_STATE) \
+    X(a, b, DRIVER_LOADING_STATE, CMD_START_SUPPLICANT, DEFER_STATE) \
+    X(a, b, DRIVER_LOADING_STATE, CMD_STOP_DRIVER, DEFER_STATE) \
+    X(a, b, DRIVER_LOADING_STATE, CMD_STOP_SUPPLICANT, DEFER_STATE) \
+    X(a, b, DRIVER_LOADING_STATE, CMD_UNLOAD_DRIVER, DEFER_STATE) \
+    X(a, b, DRIVER_STARTED_STATE, CMD_STOP_DRIVER, DRIVER_STOPPING_STATE) \
+    X(a, b, DRIVER_STARTING_STATE, AUTHENTICATION_FAILURE_EVENT, DEFER_STATE) \
+    X(a, b, DRIVER_STARTING_STATE, CMD_DISCONNECT, DEFER_STATE) \
+    X(a, b, DRIVER_STARTING_STATE, CMD_REASSOCIATE, DEFER_STATE) \
+    X(a, b, DRIVER_STARTING_STATE, CMD_RECONNECT, DEFER_STATE) \
+    X(a, b, DRIVER_STARTING_STATE, CMD_START_DRIVER, DEFER_STATE) \
+    X(a, b, DRIVER_STARTING_STATE, CMD_START_SCAN, DEFER_STATE) \
+    X(a, b, DRIVER_STARTING_STATE, CMD_STOP_DRIVER, DEFER_STATE) \
+    X(a, b, DRIVER_STARTING_STATE, NETWORK_CONNECTION_EVENT, DEFER_STATE) \
+    X(a, b, DRIVER_STARTING_STATE, NETWORK_DISCONNECTION_EVENT, DEFER_STATE) \
+    X(a, b, DRIVER_STOPPED_STATE, AUTHENTICATION_FAILURE_EVENT, DEFER_STATE) \
+    X(a, b, DRIVER_STOPPED_STATE, CMD_DISCONNECT, DEFER_STATE) \
+    X(a, b, DRIVER_STOPPED_STATE, CMD_REASSOCIATE, DEFER_STATE) \
+    X(a, b, DRIVER_STOPPED_STATE, CMD_RECONNECT, DEFER_STATE) \
+    X(a, b, DRIVER_STOPPED_STATE, CMD_STOP_DRIVER, DEFER_STATE) \
+    X(a, b, DRIVER_STOPPED_STATE, NETWORK_CONNECTION_EVENT, DEFER_STATE) \
+    X(a, b, DRIVER_STOPPED_STATE, NETWORK_DISCONNECTION_EVENT, DEFER_STATE) \
+    X(a, b, DRIVER_STOPPED_STATE, SUP_STATE_CHANGE_EVENT, DRIVER_STARTED_STATE) \
+    X(a, b, DRIVER_STOPPING_STATE, AUTHENTICATION_FAILURE_EVENT, DEFER_STATE) \
+    X(a, b, DRIVER_STOPPING_STATE, CMD_DISCONNECT, DEFER_STATE) \
+    X(a, b, DRIVER_STOPPING_STATE, CMD_REASSOCIATE, DEFER_STATE) \
+    X(a, b, DRIVER_STOPPING_STATE, CMD_RECONNECT, DEFER_STATE) \
+    X(a, b, DRIVER_STOPPING_STATE, CMD_START_DRIVER, DEFER_STATE) \
+    X(a, b, DRIVER_STOPPING_STATE, CMD_START_SCAN, DEFER_STATE) \
+    X(a, b, DRIVER_STOPPING_STATE, CMD_STOP_DRIVER, DEFER_STATE) \
+    X(a, b, DRIVER_STOPPING_STATE, NETWORK_CONNECTION_EVENT, DEFER_STATE) \
+    X(a, b, DRIVER_STOPPING_STATE, NETWORK_DISCONNECTION_EVENT, DEFER_STATE) \
+    X(a, b, DRIVER_STOPPING_STATE, SUP_STATE_CHANGE_EVENT, DRIVER_STOPPED_STATE) \
+    X(a, b, DRIVER_UNLOADED_STATE, CMD_LOAD_DRIVER, DRIVER_LOADING_STATE) \
+    X(a, b, DRIVER_UNLOADING_STATE, CMD_LOAD_DRIVER, DEFER_STATE) \
+    X(a, b, DRIVER_UNLOADING_STATE, CMD_START_DRIVER, DEFER_STATE) \
+    X(a, b, DRIVER_UNLOADING_STATE, CMD_START_SUPPLICANT, DEFER_STATE) \
+    X(a, b, DRIVER_UNLOADING_STATE, CMD_STOP_DRIVER, DEFER_STATE) \
+    X(a, b, DRIVER_UNLOADING_STATE, CMD_STOP_SUPPLICANT, DEFER_STATE) \
+    X(a, b, DRIVER_UNLOADING_STATE, CMD_UNLOAD_DRIVER, DEFER_STATE) \
+    X(a, b, DRIVER_UNLOADING_STATE, CMD_UNLOAD_DRIVER_FAILURE, DRIVER_FAILED_STATE) \
+    X(a, b, DRIVER_UNLOADING_STATE, CMD_UNLOAD_DRIVER_SUCCESS, DRIVER_UNLOADED_STATE) \
+    X(a, b, SCAN_MODE_STATE, CMD_START_SCAN, DISCONNECTED_STATE) \
+    X(a, b, SUPPLICANT_STARTING_STATE, CMD_LOAD_DRIVER, DEFER_STATE) \
+    X(a, b, SUPPLICANT_STARTING_STATE, CMD_START_DRIVER, DEFER_STATE) \
+    X(a, b, SUPPLICANT_STARTING_STATE, CMD_START_SUPPLICANT, DEFER_STATE) \
+    X(a, b, SUPPLICANT_STARTING_STATE, CMD_STOP_DRIVER, DEFER_STATE) \
+    X(a, b, SUPPLICANT_STARTING_STATE, CMD_STOP_SUPPLICANT, DEFER_STATE) \
+    X(a, b, SUPPLICANT_STARTING_STATE, CMD_UNLOAD_DRIVER, DEFER_STATE) \
+    X(a, b, SUPPLICANT_STARTING_STATE, SUP_CONNECTION_EVENT, DRIVER_STARTED_STATE) \
+    X(a, b, SUPPLICANT_STOPPING_STATE, CMD_STOP_SUPPLICANT_FAILURE, DRIVER_LOADED_STATE) \
+    X(a, b, UNUSED_STATE, ASSOCIATED_WITH_EVENT, DEFER_STATE) \
+    X(a, b, UNUSED_STATE, CMD_ADD_OR_UPDATE_NETWORK, DEFER_STATE) \
+    X(a, b, UNUSED_STATE, CMD_DISABLE_NETWORK, DEFER_STATE) \
+    X(a, b, UNUSED_STATE, CMD_ENABLE_BACKGROUND_SCAN, DEFER_STATE) \
+    X(a, b, UNUSED_STATE, CMD_ENABLE_NETWORK, DEFER_STATE) \
+    X(a, b, UNUSED_STATE, CMD_ENABLE_RSSI_POLL, DEFER_STATE) \
+    X(a, b, UNUSED_STATE, CMD_REMOVE_NETWORK, DEFER_STATE) \
+    X(a, b, UNUSED_STATE, CMD_RSSI_POLL, DEFER_STATE) \
+    X(a, b, UNUSED_STATE, CMD_SAVE_CONFIG, DEFER_STATE) \
+    X(a, b, UNUSED_STATE, CMD_SELECT_NETWORK, DEFER_STATE) \
+    X(a, b, UNUSED_STATE, CMD_STOP_SUPPLICANT_SUCCESS, DEFER_STATE) \
+    X(a, b, UNUSED_STATE, CMD_UPDATE_NETWORKS, DEFER_STATE) \
+    X(a, b, UNUSED_STATE, CTRL_EVENT_BSS_ADDED, DEFER_STATE) \
+    X(a, b, UNUSED_STATE, CTRL_EVENT_BSS_CHANGES, DEFER_STATE) \
+    X(a, b, UNUSED_STATE, CTRL_EVENT_BSS_REMOVED, DEFER_STATE) \
+    X(a, b, UNUSED_STATE, CTRL_EVENT_DRIVER_STATE, DEFER_STATE) \
+    X(a, b, UNUSED_STATE, CTRL_EVENT_EAP_FAILURE, DEFER_STATE) \
+    X(a, b, UNUSED_STATE, CTRL_EVENT_LINK_SPEED, DEFER_STATE) \
+    X(a, b, UNUSED_STATE, CTRL_EVENT_SCAN_STARTED, DEFER_STATE) \
+    X(a, b, UNUSED_STATE, CTRL_EVENT_SIGNAL_CHANGE, DEFER_STATE) \
+    X(a, b, UNUSED_STATE, KEY_COMPLETED_EVENT, DEFER_STATE) \
+    X(a, b, UNUSED_STATE, NETWORK_RECONNECTION_EVENT, DEFER_STATE) \
+    X(a, b, UNUSED_STATE, SUP_SCAN_RESULTS_EVENT, DEFER_STATE) \
+    X(a, b, UNUSED_STATE, WPS_AP_AVAILABLE_EVENT, DEFER_STATE) \
+    X(a, b, DEFAULT_STATE, CMD_CONNECT_NETWORK, DISCONNECTING_STATE) \
+    X(a, b, DEFAULT_STATE, CMD_STOP_SUPPLICANT, SUPPLICANT_STOPPING_STATE) \
+    X(a, b, DEFAULT_STATE, NETWORK_CONNECTION_EVENT, CONNECTING_STATE) \
+    X(a, b, DEFAULT_STATE, NETWORK_DISCONNECTION_EVENT, DISCONNECTED_STATE) \
+    X(a, b, DEFAULT_STATE, SUP_DISCONNECTION_EVENT, DRIVER_LOADED_STATE) \
+
+#define WIFI_FSM_INTERNAL(X, a, b) \
+    X(a, b, CONNECTED_STATE, CONNECTING_STATE) \
+    X(a, b, DRIVER_STARTED_STATE, DISCONNECTED_STATE) \
+    X(a, b, DRIVER_STARTED_STATE, SCAN_MODE_STATE) \
+    X(a, b, INITIAL_STATE, DRIVER_LOADED_STATE) \
+    X(a, b, INITIAL_STATE, DRIVER_UNLOADED_STATE) \
 
-#endif
+enum { EVENT_NONE=1,
+    WIFI_FSM_EVENTS(FSM_ENUM_EVENT, _, _)
+    MAX_WIFI_EVENT};
+enum { STATE_NONE=1,
+    WIFI_FSM_STATES(FSM_ENUM_STATE, _, _)
+    STATE_MAX};
 } /* namespace android */
+
+#endif // _WIFISTATES_H
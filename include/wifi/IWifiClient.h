@@ -87,7 +87,8 @@ protected:
 	CONFIGURED_STATIONS,
 	INFORMATION,
 	RSSI,
-	LINK_SPEED
+	LINK_SPEED,
+	SCAN_RESULTS_DELTA
     };
 
 public:
@@ -99,6 +100,14 @@ public:
     virtual void Information(const WifiInformation& info) = 0;
     virtual void Rssi(int rssi) = 0;
     virtual void LinkSpeed(int link_speed) = 0;
+    // Sent instead of ScanResults() with WIFI_CLIENT_FLAG_SCAN_DELTAS.
+    // Turns the list at generation 'base' into the list at 'generation':
+    // entries in 'changed' are new or replace the one with the same
+    // bssid, and the bssids in 'removed' are gone.  When base is 0,
+    // 'changed' is the complete list.
+    virtual void ScanResultsDelta(int base, int generation,
+				  const Vector<ScannedStation>& changed,
+				  const Vector<String8>& removed) = 0;
 };
 
 // ----------------------------------------------------------------------------
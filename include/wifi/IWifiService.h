@@ -23,7 +23,10 @@ enum WifiClientFlag {
     WIFI_CLIENT_FLAG_LINK_SPEED          = 0x20,
 
     WIFI_CLIENT_FLAG_BROADCAST           = 0x0f,  // Most common flags
-    WIFI_CLIENT_FLAG_ALL                 = 0xffff
+    WIFI_CLIENT_FLAG_ALL                 = 0xffff,
+
+    // Options, outside ALL so that they are only ever set on purpose
+    WIFI_CLIENT_FLAG_SCAN_DELTAS         = 0x10000  // ScanResultsDelta() instead of ScanResults()
 };
 
 
@@ -52,7 +55,11 @@ protected:
 	REGISTER = IBinder::FIRST_CALL_TRANSACTION,
 	SET_ENABLED,
 	SEND_COMMAND,
-	ADD_OR_UPDATE_NETWORK
+	ADD_OR_UPDATE_NETWORK,
+	RESYNC_SCAN_RESULTS,
+	SET_RSSI_HYSTERESIS,
+	ADD_OR_UPDATE_NETWORKS,
+	REMOVE_NETWORKS
     };
 
 public:
@@ -62,6 +69,15 @@ public:
     virtual void SetEnabled(bool enabled) = 0;
     virtual void SendCommand(int command, int arg1, int arg2) = 0;
     virtual void AddOrUpdateNetwork(const ConfiguredStation& cs) = 0;
+    // Send 'client' the complete scan list as a delta with base 0
+    virtual void ResyncScanResults(const sp<IWifiClient>& client) = 0;
+    // Only send 'client' Rssi() when the signal has moved 'dbm' or more
+    // since the last value it was sent (0 sends every change)
+    virtual void SetRssiHysteresis(const sp<IWifiClient>& client, int dbm) = 0;
+    // Apply many network changes at once; the configuration is saved
+    // and ConfiguredStations() sent once for the whole batch
+    virtual void AddOrUpdateNetworks(const Vector<ConfiguredStation>& stations) = 0;
+    virtual void RemoveNetworks(const Vector<int>& network_ids) = 0;
 };
 
 // ----------------------------------------------------------------------------
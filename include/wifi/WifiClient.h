@@ -10,6 +10,8 @@
 
 #include <utils/List.h>
 #include <utils/Vector.h>
+#include <utils/KeyedVector.h>
+#include <utils/threads.h>
 #include <binder/Parcel.h>
 
 namespace android {
@@ -25,16 +27,26 @@ namespace android {
 class WifiClient : public BnWifiClient, public IBinder::DeathRecipient
 {
 public:
-    // Request actions on the server
+    WifiClient();
+
+    // Request actions on the server.  With WIFI_CLIENT_FLAG_SCAN_DELTAS
+    // scan results are received as deltas and merged here, so
+    // ScanResults() still gets the full list, but ordered by BSSID
+    // rather than as the supplicant reported it.
     void Register(WifiClientFlag flags);
     void SetEnabled(bool enable);
 
     void StartScan(bool force_active);
     void EnableRssiPolling(bool enable);
+    // Rssi() is only called when the signal moves at least 'dbm'
+    void SetRssiHysteresis(int dbm);
     void EnableBackgroundScan(bool enable);
 
     void AddOrUpdateNetwork(const ConfiguredStation&);
     void RemoveNetwork(int network_id);
+    // Provisioning many networks; one save and one ConfiguredStations()
+    void AddOrUpdateNetworks(const Vector<ConfiguredStation>&);
+    void RemoveNetworks(const Vector<int>& network_ids);
     void SelectNetwork(int network_id);
     void EnableNetwork(int network_id, bool disable_others);
     void DisableNetwork(int network_id);
@@ -51,6 +63,12 @@ public:
     virtual void Rssi(int rssi) {};
     virtual void LinkSpeed(int link_speed) {};
 
+    // Merges the delta into the local view and calls ScanResults()
+    // with the whole list, ordered by BSSID
+    virtual void ScanResultsDelta(int base, int generation,
+				  const Vector<ScannedStation>& changed,
+				  const Vector<String8>& removed);
+
     static const char *supStateToString(int state);
 
 private:
@@ -59,6 +77,9 @@ private:
 
 private:
     sp<IWifiService> mWifiService;
+    Mutex            mScanLock;
+    KeyedVector<String8, ScannedStation> mScanResults;  // By bssid
+    int              mScanGeneration;   // -1 while waiting for a resync
 };
 
 };
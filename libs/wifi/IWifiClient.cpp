@@ -192,6 +192,22 @@ public:
 	data.writeInt32(link_speed);
 	remote()->transact(LINK_SPEED, data, &reply, IBinder::FLAG_ONEWAY);
     }
+
+    void ScanResultsDelta(int base, int generation,
+			  const Vector<ScannedStation>& changed,
+			  const Vector<String8>& removed) {
+	Parcel data, reply;
+	data.writeInterfaceToken(IWifiClient::getInterfaceDescriptor());
+	data.writeInt32(base);
+	data.writeInt32(generation);
+	data.writeInt32(changed.size());
+	for (size_t i = 0 ; i < changed.size() ; i++)
+	    changed[i].writeToParcel(&data);
+	data.writeInt32(removed.size());
+	for (size_t i = 0 ; i < removed.size() ; i++)
+	    data.writeString8(removed[i]);
+	remote()->transact(SCAN_RESULTS_DELTA, data, &reply, IBinder::FLAG_ONEWAY);
+    }
 };
 
 // ---------------------------------------------------------------------------
@@ -244,6 +260,21 @@ status_t BnWifiClient::onTransact( uint32_t code,
 	LinkSpeed(link_speed);
 	return NO_ERROR;
     } break;
+    case SCAN_RESULTS_DELTA: {
+	CHECK_INTERFACE(IWifiClient, data, reply);
+	int base = data.readInt32();
+	int generation = data.readInt32();
+	Vector<ScannedStation> changed;
+	int vlen = data.readInt32();
+	for (int i = 0 ; i < vlen ; i++)
+	    changed.push(ScannedStation(data));
+	Vector<String8> removed;
+	vlen = data.readInt32();
+	for (int i = 0 ; i < vlen ; i++)
+	    removed.push(data.readString8());
+	ScanResultsDelta(base, generation, changed, removed);
+	return NO_ERROR;
+    } break;
     }
     return BBinder::onTransact(code, data, reply, flags);
 }
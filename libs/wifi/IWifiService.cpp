@@ -46,6 +46,39 @@ public:
 	cs.writeToParcel(&data);
 	remote()->transact(ADD_OR_UPDATE_NETWORK, data, &reply, IBinder::FLAG_ONEWAY);
     }
+
+    void ResyncScanResults(const sp<IWifiClient>& client) {
+	Parcel data, reply;
+	data.writeInterfaceToken(IWifiService::getInterfaceDescriptor());
+	data.writeStrongBinder(client->asBinder());
+	remote()->transact(RESYNC_SCAN_RESULTS, data, &reply, IBinder::FLAG_ONEWAY);
+    }
+
+    void SetRssiHysteresis(const sp<IWifiClient>& client, int dbm) {
+	Parcel data, reply;
+	data.writeInterfaceToken(IWifiService::getInterfaceDescriptor());
+	data.writeStrongBinder(client->asBinder());
+	data.writeInt32(dbm);
+	remote()->transact(SET_RSSI_HYSTERESIS, data, &reply, IBinder::FLAG_ONEWAY);
+    }
+
+    void AddOrUpdateNetworks(const Vector<ConfiguredStation>& stations) {
+	Parcel data, reply;
+	data.writeInterfaceToken(IWifiService::getInterfaceDescriptor());
+	data.writeInt32(stations.size());
+	for (size_t i = 0 ; i < stations.size() ; i++)
+	    stations[i].writeToParcel(&data);
+	remote()->transact(ADD_OR_UPDATE_NETWORKS, data, &reply, IBinder::FLAG_ONEWAY);
+    }
+
+    void RemoveNetworks(const Vector<int>& network_ids) {
+	Parcel data, reply;
+	data.writeInterfaceToken(IWifiService::getInterfaceDescriptor());
+	data.writeInt32(network_ids.size());
+	for (size_t i = 0 ; i < network_ids.size() ; i++)
+	    data.writeInt32(network_ids[i]);
+	remote()->transact(REMOVE_NETWORKS, data, &reply, IBinder::FLAG_ONEWAY);
+    }
 };
 
 IMPLEMENT_META_INTERFACE(WifiService, "klaatu.platform.IWifiService")
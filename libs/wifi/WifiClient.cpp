@@ -6,6 +6,11 @@
 
 namespace android {
 
+WifiClient::WifiClient()
+    : mScanGeneration(0)
+{
+}
+
 void WifiClient::Register(WifiClientFlag flags)
 {
     mWifiService->Register(this, flags);
@@ -26,6 +31,11 @@ void WifiClient::EnableRssiPolling(bool enable)
     mWifiService->SendCommand(IWifiService::COMMAND_ENABLE_RSSI_POLLING, enable, 0);
 }
 
+void WifiClient::SetRssiHysteresis(int dbm)
+{
+    mWifiService->SetRssiHysteresis(this, dbm);
+}
+
 void WifiClient::EnableBackgroundScan(bool enable)
 {
     mWifiService->SendCommand(IWifiService::COMMAND_ENABLE_BACKGROUND_SCAN, enable, 0);
@@ -41,6 +51,16 @@ void WifiClient::RemoveNetwork(int network_id)
     mWifiService->SendCommand(IWifiService::COMMAND_REMOVE_NETWORK, network_id, 0);
 }
 
+void WifiClient::AddOrUpdateNetworks(const Vector<ConfiguredStation>& stations)
+{
+    mWifiService->AddOrUpdateNetworks(stations);
+}
+
+void WifiClient::RemoveNetworks(const Vector<int>& network_ids)
+{
+    mWifiService->RemoveNetworks(network_ids);
+}
+
 void WifiClient::SelectNetwork(int network_id)
 {
     mWifiService->SendCommand(IWifiService::COMMAND_SELECT_NETWORK, network_id, 0);
@@ -72,6 +92,36 @@ void WifiClient::Reassociate()
     mWifiService->SendCommand(IWifiService::COMMAND_REASSOCIATE, 0, 0);
 }
 
+void WifiClient::ScanResultsDelta(int base, int generation,
+				  const Vector<ScannedStation>& changed,
+				  const Vector<String8>& removed)
+{
+    Vector<ScannedStation> v;
+    {
+	Mutex::Autolock _l(mScanLock);
+	if (base == 0)
+	    mScanResults.clear();
+	else if (base != mScanGeneration) {
+	    // We missed a delta; ask once for the full list and ignore
+	    // deltas until it arrives
+	    if (mScanGeneration >= 0) {
+		mScanGeneration = -1;
+		mWifiService->ResyncScanResults(this);
+	    }
+	    return;
+	}
+	for (size_t i = 0 ; i < changed.size() ; i++)
+	    mScanResults.replaceValueFor(changed[i].bssid, changed[i]);
+	for (size_t i = 0 ; i < removed.size() ; i++)
+	    mScanResults.removeItem(removed[i]);
+	mScanGeneration = generation;
+	v.setCapacity(mScanResults.size());
+	for (size_t i = 0 ; i < mScanResults.size() ; i++)
+	    v.push(mScanResults.valueAt(i));
+    }
+    ScanResults(v);
+}
+
 void WifiClient::onFirstRef()
 {
     sp<IServiceManager> sm     = defaultServiceManager();